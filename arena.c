@@ -0,0 +1,143 @@
+#include "arena.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "topology.h"
+
+/**
+ * @brief Initializes an empty Arena, chunks are mapped on first use
+ *
+ * @param huge_pages int nonzero to back chunks with huge pages
+ * @return Arena* Pointer to Arena
+ */
+Arena* ArenaInit(int huge_pages) {
+    Arena* arena = (Arena*)calloc(1, sizeof(Arena));
+    if (arena == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    arena->huge_pages = huge_pages;
+    arena->node = -1;
+    return arena;
+}
+
+/**
+ * @brief Maps a new chunk of at least `size` bytes, preferring explicit huge
+ * pages and falling back to transparent ones
+ *
+ * @param size size_t bytes needed, a multiple of ARENA_CHUNK_SIZE
+ * @param huge_pages int nonzero to ask for huge pages
+ * @param node int NUMA node to place the chunk on, -1 for any
+ * @return ArenaChunk* Pointer to the mapped chunk
+ */
+ArenaChunk* arena_map_chunk(size_t size, int huge_pages, int node) {
+    void* p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (huge_pages) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            printf("Malloc error! %s\n", strerror(errno));
+            exit(1);
+        }
+#ifdef MADV_HUGEPAGE
+        if (huge_pages) madvise(p, size, MADV_HUGEPAGE);
+#endif
+    }
+    // before the header below touches the first page
+    if (node >= 0) TopologyBind(p, size, node);
+
+    ArenaChunk* chunk = (ArenaChunk*)p;
+    chunk->size = size;
+    return chunk;
+}
+
+/**
+ * @brief Allocates `size` bytes by bumping the current chunk, taking a new
+ * one when it is full
+ *
+ * @param arena Pointer to Arena
+ * @param size size_t bytes to allocate
+ * @return void* Pointer to memory aligned to ARENA_ALIGN
+ */
+void* ArenaAlloc(Arena* arena, size_t size) {
+    void* p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (arena->curr == NULL || arena->curr + size > arena->end) {
+        size_t header =
+            (sizeof(ArenaChunk) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+        size_t chunk_size = ARENA_CHUNK_SIZE;
+        while (chunk_size < header + size) chunk_size += ARENA_CHUNK_SIZE;
+
+        // a chunk kept by ArenaReset goes first, it is mapped already
+        ArenaChunk** spare = &arena->spare;
+        while (*spare != NULL && (*spare)->size < chunk_size) {
+            spare = &(*spare)->next;
+        }
+        ArenaChunk* chunk = *spare;
+        if (chunk != NULL) {
+            *spare = chunk->next;
+            chunk_size = chunk->size;
+        } else {
+            chunk = arena_map_chunk(chunk_size, arena->huge_pages,
+                                    arena->node);
+            arena->allocated += chunk_size;
+        }
+        arena->in_use += chunk_size;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->curr = (char*)chunk + header;
+        arena->end = (char*)chunk + chunk_size;
+    }
+
+    p = arena->curr;
+    arena->curr += size;
+    return p;
+}
+
+/**
+ * @brief Drops every allocation at once. The chunks stay mapped and are
+ * handed out again before new ones are mapped.
+ *
+ * @param arena Pointer to Arena
+ */
+void ArenaReset(Arena* arena) {
+    ArenaChunk* chunk = arena->chunks;
+    while (chunk != NULL) {
+        ArenaChunk* next = chunk->next;
+        chunk->next = arena->spare;
+        arena->spare = chunk;
+        chunk = next;
+    }
+    arena->chunks = NULL;
+    arena->curr = NULL;
+    arena->end = NULL;
+    arena->in_use = 0;
+}
+
+/**
+ * @brief Frees every chunk of the arena and the arena itself
+ *
+ * @param arena Pointer to Arena
+ */
+void ArenaFree(Arena* arena) {
+    ArenaReset(arena);
+    ArenaChunk* chunk = arena->spare;
+    while (chunk != NULL) {
+        ArenaChunk* next = chunk->next;
+        munmap(chunk, chunk->size);
+        chunk = next;
+    }
+    free(arena);
+}
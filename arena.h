@@ -0,0 +1,31 @@
+#ifndef __arena_h__
+#define __arena_h__
+#include "stddef.h"
+
+// chunks are one huge page so they can be backed by one when asked to
+#define ARENA_CHUNK_SIZE (2 * 1024 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size;
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk* chunks;
+    ArenaChunk* spare;  // chunks kept by ArenaReset for reuse
+    char* curr;
+    char* end;
+    size_t allocated;  // bytes mapped for chunks
+    size_t in_use;     // bytes of the chunks handed out since ArenaReset
+    int huge_pages;
+    int node;  // NUMA node new chunks are bound to, -1 for first touch
+} Arena;
+
+// External Functions
+Arena* ArenaInit(int huge_pages);
+void* ArenaAlloc(Arena* arena, size_t size);
+void ArenaReset(Arena* arena);
+void ArenaFree(Arena* arena);
+
+#endif  // __arena_h__
@@ -0,0 +1,144 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// number of distinct words of each corpus and how they are spread
+#define VOCABULARY_SIZE 50000
+#define LONG_VOCABULARY_SIZE 10000
+#define ZIPF_EXPONENT 1.1
+#define WORDS_PER_LINE 12
+#define SMALL_FILES 1000
+#define DEFAULT_FILES 8
+
+typedef struct {
+    char **words;
+    size_t size;
+    double *cdf;  // zipf only, cumulative probability of words[0..i]
+} Vocabulary;
+
+unsigned long seed;
+
+unsigned long next_random(void) {
+    // xorshift
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+char *random_word(size_t min_len, size_t max_len) {
+    size_t len = min_len + next_random() % (max_len - min_len + 1);
+    char *word = (char *)malloc(len + 1);
+    if (word == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    for (size_t i = 0; i < len; i++) {
+        word[i] = 'a' + next_random() % 26;
+    }
+    word[len] = '\0';
+    return word;
+}
+
+void VocabularyInit(Vocabulary *v, size_t size, size_t min_len,
+                    size_t max_len, int zipf) {
+    v->size = size;
+    v->words = (char **)malloc(sizeof(char *) * size);
+    v->cdf = NULL;
+    for (size_t i = 0; i < size; i++) {
+        v->words[i] = random_word(min_len, max_len);
+    }
+    if (zipf) {
+        double sum = 0;
+        v->cdf = (double *)malloc(sizeof(double) * size);
+        for (size_t i = 0; i < size; i++) {
+            sum += 1.0 / pow(i + 1, ZIPF_EXPONENT);
+            v->cdf[i] = sum;
+        }
+        for (size_t i = 0; i < size; i++) v->cdf[i] /= sum;
+    }
+}
+
+char *VocabularyPick(Vocabulary *v) {
+    if (v->cdf == NULL) {
+        return v->words[next_random() % v->size];
+    }
+    // first word whose cumulative probability reaches u
+    double u = (double)(next_random() >> 11) / (double)(1UL << 53);
+    size_t lo = 0, hi = v->size - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (v->cdf[mid] < u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return v->words[lo];
+}
+
+/**
+ * @brief Writes `bytes` bytes worth of lines of random words to a file
+ */
+void write_file(char *path, Vocabulary *v, size_t bytes) {
+    FILE *fp = fopen(path, "w");
+    size_t written = 0;
+
+    if (fp == NULL) {
+        printf("Cannot open %s! %s\n", path, strerror(errno));
+        exit(1);
+    }
+    while (written < bytes) {
+        for (int i = 0; i < WORDS_PER_LINE; i++) {
+            char *word = VocabularyPick(v);
+            written += fprintf(fp, i == 0 ? "%s" : " %s", word);
+        }
+        fputc('\n', fp);
+        written += 1;
+    }
+    fclose(fp);
+    printf("%s\n", path);
+}
+
+/* Usage: gencorpus <shape> <dir> <megabytes> [seed]
+ *
+ * Shapes: uniform, zipf, longkey, smallfiles, hugefile. Writes about
+ * <megabytes> MB of text into <dir> and prints the name of every file. */
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        printf("Invalid usage: ./gencorpus <shape> <dir> <megabytes> [seed]\n");
+        return 1;
+    }
+    char *shape = argv[1], *dir = argv[2];
+    size_t bytes = (size_t)(atof(argv[3]) * 1024 * 1024);
+    int files = DEFAULT_FILES;
+    Vocabulary v;
+    char path[4096];
+
+    seed = argc > 4 ? strtoul(argv[4], NULL, 10) | 1 : 0x9e3779b97f4a7c15UL;
+    if (strcmp(shape, "uniform") == 0) {
+        VocabularyInit(&v, VOCABULARY_SIZE, 3, 10, 0);
+    } else if (strcmp(shape, "zipf") == 0) {
+        VocabularyInit(&v, VOCABULARY_SIZE, 3, 10, 1);
+    } else if (strcmp(shape, "longkey") == 0) {
+        VocabularyInit(&v, LONG_VOCABULARY_SIZE, 64, 256, 0);
+    } else if (strcmp(shape, "smallfiles") == 0) {
+        VocabularyInit(&v, VOCABULARY_SIZE, 3, 10, 0);
+        files = SMALL_FILES;
+    } else if (strcmp(shape, "hugefile") == 0) {
+        VocabularyInit(&v, VOCABULARY_SIZE, 3, 10, 0);
+        files = 1;
+    } else {
+        printf("Unknown shape %s!\n", shape);
+        return 1;
+    }
+
+    for (int i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s/%s-%04d.txt", dir, shape, i);
+        write_file(path, &v, bytes / files);
+    }
+    return 0;
+}
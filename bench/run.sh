@@ -0,0 +1,66 @@
+#!/bin/sh
+# Benchmarks mapreduce.c against sequential_mapreduce.c with the same word
+# count, over synthetic corpora and a sweep of mapper/reducer counts.
+#
+# Usage: bench/run.sh [megabytes] [results file]
+#
+# Prints one JSON object per run (see bench/wordcount.c) and also appends
+# them to the results file, $TMPDIR/mapreduce-bench.jsonl by default. Mapper
+# and reducer counts are swept independently, every count of MAPPERS with
+# every count of REDUCERS. Both default to THREADS, which is 1, 2, 4, ... up
+# to the number of online cores. Set MAPPERS, REDUCERS, THREADS (e.g.
+# THREADS="1 4 16") or SHAPES to override.
+
+set -e
+cd "$(dirname "$0")/.."
+
+MB=${1:-64}
+RESULTS=${2:-${TMPDIR:-/tmp}/mapreduce-bench.jsonl}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+SHAPES=${SHAPES:-"uniform zipf longkey smallfiles hugefile"}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+if [ -z "$THREADS" ]; then
+    cores=$(getconf _NPROCESSORS_ONLN)
+    THREADS=1
+    n=2
+    while [ "$n" -le "$cores" ]; do
+        THREADS="$THREADS $n"
+        n=$((n * 2))
+    done
+fi
+MAPPERS=${MAPPERS:-$THREADS}
+REDUCERS=${REDUCERS:-$THREADS}
+
+COMMON="bench/wordcount.c input.c tokenizer.c"
+# libnuma is optional, topology.c falls back without it
+NUMA=
+if printf '#include <numa.h>\nint main(void) { return numa_available(); }\n' |
+    $CC -x c -o "$WORK/numa" - -lnuma 2>/dev/null; then
+    NUMA="-DMR_HAVE_LIBNUMA -lnuma"
+fi
+$CC $CFLAGS -pthread -o "$WORK/parallel" $COMMON mapreduce.c arena.c \
+    scheduler.c stats.c topology.c sketch.c $NUMA
+$CC $CFLAGS -o "$WORK/sequential" $COMMON sequential_mapreduce.c
+$CC $CFLAGS -o "$WORK/gencorpus" bench/gencorpus.c -lm
+
+for shape in $SHAPES; do
+    mkdir "$WORK/$shape"
+    "$WORK/gencorpus" "$shape" "$WORK/$shape" "$MB" > /dev/null
+    files=$(ls "$WORK/$shape"/*.txt)
+
+    # the sequential run is the baseline for speedup and efficiency
+    line=$("$WORK/sequential" sequential "$shape" 1 1 0 $files)
+    echo "$line" | tee -a "$RESULTS"
+    baseline=$(echo "$line" | sed 's/.*"seconds": \([0-9.]*\).*/\1/')
+
+    for m in $MAPPERS; do
+        for r in $REDUCERS; do
+            "$WORK/parallel" parallel "$shape" "$m" "$r" "$baseline" $files |
+                tee -a "$RESULTS"
+        done
+    done
+    rm -rf "$WORK/$shape"
+done
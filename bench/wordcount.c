@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "../input.h"
+#include "../mapreduce.h"
+
+// Word count used to benchmark a MapReduce implementation. Built once
+// against mapreduce.c and once against sequential_mapreduce.c, it only uses
+// the calls both of them provide.
+
+// files are cut into ranges of this many bytes so that a single big file
+// still keeps every mapper busy
+#define SPLIT_SIZE (4L * 1024 * 1024)
+
+// summed up by every mapper and reducer thread at once
+size_t records;
+size_t keys;
+size_t total;
+
+void MapRange(char *file_name, long offset, long length) {
+    MR_Input in;
+    MR_Tokenizer tokenizer;
+    char *line, *token;
+    size_t len, token_len, n = 0;
+
+    if (MR_InputOpen(&in, file_name, offset, length) != 0) exit(1);
+    while ((line = MR_InputNextLine(&in, &len)) != NULL) {
+        MR_TokenizerInit(&tokenizer, line, len);
+        while ((token = MR_NextToken(&tokenizer, &token_len)) != NULL) {
+            token[token_len] = '\0';
+            MR_EmitInt(token, 1);
+            n++;
+        }
+    }
+    MR_InputClose(&in);
+    __atomic_add_fetch(&records, n, __ATOMIC_RELAXED);
+}
+
+void Map(char *file_name) { MapRange(file_name, 0, -1); }
+
+void Reduce(char *key, Getter get_next, int partition_number) {
+    long count = 0, value;
+
+    while (MR_GetInt(get_next, key, partition_number, &value)) count += value;
+    __atomic_add_fetch(&keys, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total, count, __ATOMIC_RELAXED);
+}
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Usage: wordcount <impl> <corpus> <mappers> <reducers> <baseline> <file>...
+ *
+ * Runs one job and prints one JSON line. <baseline> is the wall time of the
+ * single threaded run of the same corpus (0 if unknown), used to work out
+ * speedup and scaling efficiency. */
+
+int main(int argc, char *argv[]) {
+    if (argc < 7) {
+        printf(
+            "Invalid usage: ./wordcount <impl> <corpus> <mappers> <reducers> "
+            "<baseline> <file> ...\n");
+        return 1;
+    }
+    char *impl = argv[1], *corpus = argv[2];
+    int mappers = atoi(argv[3]), reducers = atoi(argv[4]);
+    double baseline = atof(argv[5]);
+    size_t bytes = 0;
+    struct stat st;
+    struct rusage usage;
+
+    for (int i = 6; i < argc; i++) {
+        if (stat(argv[i], &st) == 0) bytes += st.st_size;
+    }
+
+    MR_Options options = {0};
+    options.map_range = MapRange;
+    options.split_size = SPLIT_SIZE;
+
+    // MR_RunWithOptions takes the files from argv[1] on
+    argv[5] = argv[0];
+    double start = now();
+    MR_RunWithOptions(argc - 5, argv + 5, Map, mappers, Reduce, reducers,
+                      MR_DefaultHashPartition, &options);
+    double seconds = now() - start;
+    getrusage(RUSAGE_SELF, &usage);
+
+    if (total != records) {
+        printf("Lost records! emitted %zu, reduced %zu\n", records, total);
+        return 1;
+    }
+
+    int threads = mappers > reducers ? mappers : reducers;
+    double speedup = baseline > 0 ? baseline / seconds : 0;
+    printf(
+        "{\"impl\": \"%s\", \"corpus\": \"%s\", \"mappers\": %d, "
+        "\"reducers\": %d, \"files\": %d, \"bytes\": %zu, \"records\": %zu, "
+        "\"keys\": %zu, \"seconds\": %.6f, \"records_per_s\": %.0f, "
+        "\"mb_per_s\": %.2f, \"peak_rss_kb\": %ld, \"speedup\": %.3f, "
+        "\"efficiency\": %.3f}\n",
+        impl, corpus, mappers, reducers, argc - 6, bytes, records, keys,
+        seconds, records / seconds, bytes / seconds / (1024 * 1024),
+        usage.ru_maxrss, speedup, speedup / threads);
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef __hash_h__
+#define __hash_h__
+#include <string.h>
+
+#include "stddef.h"
+
+// wyhash constants
+#define HASH_SEED 0xa0761d6478bd642fUL
+#define HASH_MUL 0xe7037ed1a0b428dbUL
+
+/**
+ * @brief Multiplies into 128 bits and folds the halves together
+ */
+static inline unsigned long hash_mix(unsigned long a, unsigned long b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (unsigned long)r ^ (unsigned long)(r >> 64);
+}
+
+/**
+ * @brief 64-bit hash in the style of wyhash, consuming 8 bytes per step.
+ * Keys are hashed once with it when emitted and the value travels with the
+ * record, so partitioning, grouping and the HashMap all agree on it.
+ *
+ * @param data Pointer to the bytes to hash
+ * @param len size_t number of bytes
+ * @return unsigned long hash
+ */
+static inline unsigned long HashBytes(const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    unsigned long hash = HASH_SEED ^ len;
+    unsigned long word;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&word, p, sizeof(word));
+        hash = hash_mix(hash ^ word, HASH_MUL);
+    }
+    // the last few bytes, little-endian
+    word = 0;
+    for (size_t i = 0; i < len; i++) {
+        word |= (unsigned long)p[i] << (8 * i);
+    }
+    return hash_mix(hash_mix(hash ^ word, HASH_MUL), HASH_SEED ^ HASH_MUL);
+}
+
+#endif  // __hash_h__
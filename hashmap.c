@@ -1,12 +1,40 @@
 #include "hashmap.h"
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#define FNV_OFFSET 14695981039346656037UL
-#define FNV_PRIME 1099511628211UL
+
+/**
+ * @brief Allocates an empty table of `capacity` slots
+ *
+ * @param capacity size_t power of two, at least MAP_GROUP_WIDTH
+ * @return MapTable* Pointer to MapTable, NULL on failure
+ */
+MapTable* map_table_init(size_t capacity) {
+    // header, then ctrl aligned for vector loads, then hashes and contents
+    size_t ctrl_offset = (sizeof(MapTable) + 15) & ~(size_t)15;
+    size_t hashes_offset = ctrl_offset + capacity;
+    size_t contents_offset = hashes_offset + capacity * sizeof(size_t);
+    char* block = (char*)aligned_alloc(
+        16, (contents_offset + capacity * sizeof(MapPair*) + 15) & ~15UL);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    MapTable* table = (MapTable*)block;
+    table->capacity = capacity;
+    table->ctrl = (unsigned char*)(block + ctrl_offset);
+    table->hashes = (size_t*)(block + hashes_offset);
+    table->contents = (MapPair**)(block + contents_offset);
+    memset(table->ctrl, MAP_CTRL_EMPTY, capacity);
+    return table;
+}
 
 /**
  * @brief Initializes HasMap
@@ -15,54 +43,300 @@
  */
 HashMap* MapInit(void) {
     HashMap* hashmap = (HashMap*)malloc(sizeof(HashMap));
-    hashmap->contents = (MapPair**)calloc(MAP_INIT_CAPACITY, sizeof(MapPair*));
-    hashmap->capacity = MAP_INIT_CAPACITY;
+    hashmap->table = map_table_init(MAP_INIT_CAPACITY);
     hashmap->size = 0;
+    hashmap->deferred_free = 0;
+    hashmap->retired = NULL;
+    hashmap->num_retired = 0;
+    hashmap->retired_capacity = 0;
     return hashmap;
 }
 
 /**
- * @brief Inserts key value pair in hashmap
+ * @brief Frees memory the map no longer uses, or keeps it until MapFree when
+ * lock-free readers might still be looking at it
+ *
+ * @param map Pointer to HashMap
+ * @param ptr Pointer to free
+ */
+void map_release(HashMap* map, void* ptr) {
+    if (!map->deferred_free) {
+        free(ptr);
+        return;
+    }
+    if (map->num_retired == map->retired_capacity) {
+        map->retired_capacity =
+            map->retired_capacity == 0 ? 16 : map->retired_capacity * 2;
+        map->retired =
+            realloc(map->retired, sizeof(void*) * map->retired_capacity);
+        if (map->retired == NULL) {
+            printf("Malloc error! %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+    map->retired[map->num_retired++] = ptr;
+}
+
+/**
+ * @brief Bitmask of the bytes of a control group equal to `byte`
+ */
+unsigned int map_match(const unsigned char* ctrl, unsigned char byte) {
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < MAP_GROUP_WIDTH; i++) {
+        if (ctrl[i] == byte) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * @brief Bitmask of the unused slots of a control group
+ */
+unsigned int map_match_empty(const unsigned char* ctrl) {
+#ifdef __SSE2__
+    // only MAP_CTRL_EMPTY has its top bit set
+    return _mm_movemask_epi8(_mm_load_si128((const __m128i*)ctrl));
+#else
+    return map_match(ctrl, MAP_CTRL_EMPTY);
+#endif
+}
+
+/**
+ * @brief Finds the slot holding `key`. A whole group of control bytes is
+ * compared at once and the stored hashes weed out fingerprint collisions, so
+ * strcmp only runs on keys that almost surely match.
+ *
+ * @param table Pointer to MapTable
+ * @param key Char pointer to key
+ * @param hash size_t Hash of key
+ * @return size_t slot index, table->capacity if not found
+ */
+size_t map_find(MapTable* table, char* key, size_t hash) {
+    size_t mask = table->capacity - 1;
+    size_t group = (hash >> 7) & mask & ~(size_t)(MAP_GROUP_WIDTH - 1);
+    unsigned char h2 = hash & 0x7f;
+
+    for (;;) {
+        unsigned int match = map_match(table->ctrl + group, h2);
+        // slots are written before their control byte is published
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        while (match != 0) {
+            size_t i = group + __builtin_ctz(match);
+            MapPair* entry = __atomic_load_n(&table->contents[i],
+                                             __ATOMIC_ACQUIRE);
+            if (table->hashes[i] == hash && !strcmp(key, entry->key)) {
+                return i;
+            }
+            match &= match - 1;
+        }
+        // nothing is ever deleted, so a free slot ends the probe sequence
+        if (map_match_empty(table->ctrl + group) != 0) {
+            return table->capacity;
+        }
+        group = (group + MAP_GROUP_WIDTH) & mask;
+    }
+}
+
+/**
+ * @brief Places a new entry in the first free slot of its probe sequence
+ *
+ * @param table Pointer to MapTable with at least one free slot
+ * @param hash size_t Hash of the entry's key
+ * @param entry Pointer to MapPair
+ */
+void map_insert(MapTable* table, size_t hash, MapPair* entry) {
+    size_t mask = table->capacity - 1;
+    size_t group = (hash >> 7) & mask & ~(size_t)(MAP_GROUP_WIDTH - 1);
+    unsigned int empty;
+
+    while ((empty = map_match_empty(table->ctrl + group)) == 0) {
+        group = (group + MAP_GROUP_WIDTH) & mask;
+    }
+    size_t i = group + __builtin_ctz(empty);
+    table->hashes[i] = hash;
+    table->contents[i] = entry;
+    // publish the slot only once it is fully written
+    __atomic_store_n(&table->ctrl[i], hash & 0x7f, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Allocates a pair for `key`, short keys are copied into the pair
  *
- * @param hashmap Pointer to hashmap
  * @param key Char pointer to key
+ * @return MapPair* Pointer to MapPair without a value
+ */
+MapPair* map_pair_init(char* key) {
+    MapPair* pair = (MapPair*)malloc(sizeof(MapPair));
+    if (pair == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    size_t key_len = strlen(key);
+    if (key_len < MAP_INLINE_KEY_SIZE) {
+        pair->key = pair->inline_key;
+        memcpy(pair->key, key, key_len + 1);
+    } else {
+        pair->key = strdup(key);
+    }
+    pair->value = NULL;
+    pair->value_size = 0;
+    pair->marked = 0;
+    return pair;
+}
+
+/**
+ * @brief Copies a value a writer may be overwriting in place. Values are at
+ * least 8-byte aligned, and are read a word at a time with relaxed atomics
+ * so that a copy the seqlock throws away is not a data race.
+ *
+ * @param out Void pointer receiving the bytes
+ * @param value Void pointer to the value
+ * @param size size_t bytes to copy
+ */
+void map_value_load(void* out, void* value, size_t size) {
+    size_t i = 0;
+    long word;
+
+    for (; i + sizeof(long) <= size; i += sizeof(long)) {
+        word = __atomic_load_n((long*)((char*)value + i), __ATOMIC_RELAXED);
+        memcpy((char*)out + i, &word, sizeof(long));
+    }
+    for (; i < size; i++) {
+        ((char*)out)[i] =
+            __atomic_load_n((char*)value + i, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Overwrites a value readers may be copying, the counterpart of
+ * map_value_load
+ *
+ * @param value Void pointer to the value
+ * @param in Void pointer to the new bytes
+ * @param size size_t bytes to copy
+ */
+void map_value_store(void* value, void* in, size_t size) {
+    size_t i = 0;
+    long word;
+
+    for (; i + sizeof(long) <= size; i += sizeof(long)) {
+        memcpy(&word, (char*)in + i, sizeof(long));
+        __atomic_store_n((long*)((char*)value + i), word, __ATOMIC_RELAXED);
+    }
+    for (; i < size; i++) {
+        __atomic_store_n((char*)value + i, ((char*)in)[i], __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Gives the pair a copy of `value`, fresh pairs keep small values
+ * inline
+ *
+ * @param map Pointer to HashMap
+ * @param pair Pointer to MapPair
  * @param value Void pointer to value
- * @param value_size int value of size of HashMap
+ * @param value_size int size of value
  */
-void MapPut(HashMap* hashmap, char* key, void* value, int value_size) {
-    // resize hashmap if half filled
-    if (hashmap->size > (hashmap->capacity / 2)) {
-        if (resize_map(hashmap) < 0) {
-            exit(0);
+void map_pair_set(HashMap* map, MapPair* pair, void* value, int value_size) {
+    void* old = pair->value;
+
+    // same size, overwrite in place. ConcurrentHashMap writers get here
+    // inside the shard's seqlock write section, so a reader that overlaps
+    // the copy retries.
+    if (old != NULL && pair->value_size == value_size) {
+        map_value_store(old, value, value_size);
+        return;
+    }
+
+    void* newvalue;
+    if (old == NULL && value_size <= sizeof(pair->inline_value)) {
+        newvalue = &pair->inline_value;
+    } else {
+        newvalue = malloc(value_size);
+        if (newvalue == NULL) {
+            printf("Malloc error! %s\n", strerror(errno));
+            exit(1);
         }
     }
+    memcpy(newvalue, value, value_size);
+    __atomic_store_n(&pair->value_size, value_size, __ATOMIC_RELAXED);
+    __atomic_store_n(&pair->value, newvalue, __ATOMIC_RELEASE);
+
+    if (old != NULL && old != &pair->inline_value) {
+        map_release(map, old);
+    }
+}
+
+/**
+ * @brief Finds the pair of `key`
+ *
+ * @param map Pointer to HashMap
+ * @param key Char pointer to key
+ * @param hash size_t Hash of key
+ * @return MapPair* Pointer to MapPair, NULL if not found
+ */
+MapPair* map_lookup(HashMap* map, char* key, size_t hash) {
+    // a resize swaps in the whole new table with one store
+    MapTable* table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+    size_t h = map_find(table, key, hash);
+
+    if (h == table->capacity) {
+        return NULL;
+    }
+    return __atomic_load_n(&table->contents[h], __ATOMIC_ACQUIRE);
+}
 
-    // initialize new kv pair and hash value
-    MapPair* newpair = (MapPair*)malloc(sizeof(MapPair));
-    int h;
+/**
+ * @brief Inserts key value pair whose hash is already known, saving the
+ * pass over the key
+ *
+ * @param map Pointer to HashMap
+ * @param key Char pointer to key
+ * @param hash size_t Hash(key), e.g. MR_CurrentKeyHash() in a reducer
+ * @param value Void pointer to value
+ * @param value_size int size of value
+ */
+void MapPutHashed(HashMap* map, char* key, size_t hash, void* value,
+                  int value_size) {
+    MapPair* pair = map_lookup(map, key, hash);
 
-    newpair->key = strdup(key);
-    newpair->value = (void*)malloc(value_size);
-    newpair->marked = 0;
-    memcpy(newpair->value, value, value_size);
-    h = Hash(key, hashmap->capacity);
+    // if keys are equal, update (overrides)
+    if (pair != NULL) {
+        map_pair_set(map, pair, value, value_size);
+        return;
+    }
 
-    // if hashmap index is not empty
-    while (hashmap->contents[h] != NULL) {
-        // if keys are equal, update (overrides)
-        if (!strcmp(key, hashmap->contents[h]->key)) {
-            free(hashmap->contents[h]);
-            hashmap->contents[h] = newpair;
-            return;
+    // resize hashmap once it is 7/8 full
+    MapTable* table = map->table;
+    if (map->size + 1 > table->capacity - table->capacity / 8) {
+        if (resize_map(map) < 0) {
+            exit(0);
         }
-        h++;
-        if (h == hashmap->capacity) h = 0;
+        table = map->table;
     }
 
-    // key not found in hashmap, h is an empty slot
-    // add pair to hashmap
-    hashmap->contents[h] = newpair;
-    hashmap->size += 1;
+    // key not found in hashmap, add pair to hashmap
+    pair = map_pair_init(key);
+    map_pair_set(map, pair, value, value_size);
+    map_insert(table, hash, pair);
+    map->size += 1;
+}
+
+/**
+ * @brief Inserts key value pair in hashmap. Updating a key with a value of
+ * the same size allocates nothing.
+ *
+ * @param hashmap Pointer to hashmap
+ * @param key Char pointer to key
+ * @param value Void pointer to value
+ * @param value_size int value of size of HashMap
+ */
+void MapPut(HashMap* hashmap, char* key, void* value, int value_size) {
+    MapPutHashed(hashmap, key, Hash(key), value, value_size);
 }
 
 /**
@@ -73,21 +347,59 @@ void MapPut(HashMap* hashmap, char* key, void* value, int value_size) {
  * @return char* to value, NULL if not found
  */
 void* MapGet(HashMap* hashmap, char* key) {
-    int h = Hash(key, hashmap->capacity);
-    while (hashmap->contents[h] != NULL) {
-        if (!strcmp(key, hashmap->contents[h]->key)) {
-            // printf("key: %s FOUND!\n", key);
-            // printf("returning %s\n", (char*)hashmap->contents[h]->value);
-            return hashmap->contents[h]->value;
-        }
-        h++;
-        if (h == hashmap->capacity) {
-            h = 0;
-        }
+    return MapGetHashed(hashmap, key, Hash(key));
+}
+
+/**
+ * @brief Get value of key value pair whose hash is already known
+ *
+ * @param hashmap Pointer to hashmap
+ * @param key Char pointer to key
+ * @param hash size_t Hash(key)
+ * @return void* to value, NULL if not found
+ */
+void* MapGetHashed(HashMap* hashmap, char* key, size_t hash) {
+    MapPair* pair = map_lookup(hashmap, key, hash);
+
+    if (pair != NULL) {
+        return __atomic_load_n(&pair->value, __ATOMIC_ACQUIRE);
     }
     return NULL;
 }
 
+/**
+ * @brief value + delta, clamped to the range of int instead of overflowing
+ */
+int map_add_saturated(int value, int delta) {
+    int sum;
+
+    if (__builtin_add_overflow(value, delta, &sum)) {
+        return delta > 0 ? INT_MAX : INT_MIN;
+    }
+    return sum;
+}
+
+/**
+ * @brief Adds `delta` to the int value of `key`, inserting it as `delta`
+ * when missing. The value stops at INT_MAX or INT_MIN.
+ *
+ * @param hashmap Pointer to hashmap
+ * @param key Char pointer to key
+ * @param delta int to add
+ * @return int the new value
+ */
+int MapAddInt(HashMap* hashmap, char* key, int delta) {
+    size_t hash = Hash(key);
+    MapPair* pair = map_lookup(hashmap, key, hash);
+
+    if (pair == NULL) {
+        MapPutHashed(hashmap, key, hash, &delta, sizeof(int));
+        return delta;
+    }
+    int* value = (int*)pair->value;
+    return *value = map_add_saturated(*value, delta);
+}
+
 /**
  * @brief Get size of hashmap
  *
@@ -103,72 +415,283 @@ size_t MapSize(HashMap* map) { return map->size; }
  * @return int 0 for success
  */
 int resize_map(HashMap* map) {
-    MapPair** temp;
-    size_t newcapacity = map->capacity * 2;  // double the capacity
-
-    // allocate a new hashmap table
-    temp = (MapPair**)calloc(newcapacity, sizeof(MapPair*));
+    MapTable* old = map->table;
+    // allocate a new hashmap table, double the capacity
+    MapTable* temp = map_table_init(old->capacity * 2);
     if (temp == NULL) {
         printf("Malloc error! %s\n", strerror(errno));
         return -1;
     }
 
-    size_t i;
-    int h;
-    MapPair* entry;
-    // rehash all the old entries to fit the new table
-    for (i = 0; i < map->capacity; i++) {
-        if (map->contents[i] != NULL)
-            entry = map->contents[i];
-        else
-            continue;
-        h = Hash(entry->key, newcapacity);
-        while (temp[h] != NULL) {
-            h++;
-            if (h == newcapacity) h = 0;
+    // move the entries over, the stored hashes spare rehashing every key
+    for (size_t i = 0; i < old->capacity; i++) {
+        if (old->ctrl[i] != MAP_CTRL_EMPTY) {
+            map_insert(temp, old->hashes[i], old->contents[i]);
         }
-        temp[h] = entry;
     }
 
-    // free the old table
-    free(map->contents);
-    // update contents with the new table, increase hashmap capacity
-    map->contents = temp;
-    map->capacity = newcapacity;
+    // update the map with the new table, then free the old one
+    __atomic_store_n(&map->table, temp, __ATOMIC_RELEASE);
+    map_release(map, old);
     return 0;
 }
 
 /**
- * @brief FNV-1a hashing algorithm
- * https://en.wikipedia.org/wiki/Fowler-Noll-Vo_hash_function#FNV-1a_hash
+ * @brief Frees the map, its pairs and anything it kept for readers
+ *
+ * @param map Pointer to HashMap
+ */
+void MapFree(HashMap* map) {
+    MapTable* table = map->table;
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->ctrl[i] != MAP_CTRL_EMPTY) {
+            MapPair* pair = table->contents[i];
+            if (pair->key != pair->inline_key) free(pair->key);
+            if (pair->value != &pair->inline_value) free(pair->value);
+            free(pair);
+        }
+    }
+    for (size_t i = 0; i < map->num_retired; i++) {
+        free(map->retired[i]);
+    }
+    free(map->retired);
+    free(table);
+    free(map);
+}
+
+/**
+ * @brief Hashes a key with HashBytes, the same hash MR_Emit stores with
+ * every record
  *
  * @param key char* of key
- * @param capacity size_t size of HashMap
- * @return hashed value (index of HashMap)
+ * @return size_t full hash, tables pick slots and fingerprints from its bits
+ */
+size_t Hash(char* key) { return HashBytes(key, strlen(key)); }
+
+/**
+ * @brief Initializes ConcurrentHashMap
+ *
+ * @return ConcurrentHashMap* Pointer to ConcurrentHashMap
  */
-size_t Hash(char* key, size_t capacity) {
-    size_t hash = FNV_OFFSET;
-    for (const char* p = key; *p; p++) {
-        hash ^= (size_t)(unsigned char)(*p);
-        hash *= FNV_PRIME;
-        hash ^= (size_t)(*p);
+ConcurrentHashMap* CMapInit(void) {
+    ConcurrentHashMap* map =
+        (ConcurrentHashMap*)malloc(sizeof(ConcurrentHashMap));
+    map->num_shards = 1 << CMAP_SHARD_BITS;
+    map->shards = (MapShard*)calloc(map->num_shards, sizeof(MapShard));
+    for (size_t i = 0; i < map->num_shards; i++) {
+        pthread_mutex_init(&map->shards[i].lock, NULL);
+        map->shards[i].seq = 0;
+        map->shards[i].map = MapInit();
+        map->shards[i].map->deferred_free = 1;
     }
-    return (hash % capacity);
+    return map;
+}
+
+/**
+ * @brief Picks a key's shard from the top hash bits, the low ones pick the
+ * slot inside the shard
+ */
+MapShard* cmap_shard(ConcurrentHashMap* map, size_t hash) {
+    return &map->shards[hash >> (64 - CMAP_SHARD_BITS)];
+}
+
+/**
+ * @brief Inserts key value pair, safe to call from many threads
+ *
+ * @param map Pointer to ConcurrentHashMap
+ * @param key Char pointer to key
+ * @param value Void pointer to value
+ * @param value_size int size of value
+ */
+void CMapPut(ConcurrentHashMap* map, char* key, void* value, int value_size) {
+    CMapPutHashed(map, key, Hash(key), value, value_size);
+}
+
+/**
+ * @brief Inserts key value pair whose hash is already known
+ *
+ * @param map Pointer to ConcurrentHashMap
+ * @param key Char pointer to key
+ * @param hash size_t Hash(key)
+ * @param value Void pointer to value
+ * @param value_size int size of value
+ */
+void CMapPutHashed(ConcurrentHashMap* map, char* key, size_t hash, void* value,
+                   int value_size) {
+    MapShard* shard = cmap_shard(map, hash);
+
+    pthread_mutex_lock(&shard->lock);
+    // readers that overlap this write will retry
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    MapPutHashed(shard->map, key, hash, value, value_size);
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * @brief Get value of key value pair without taking any lock
+ *
+ * @param map Pointer to ConcurrentHashMap
+ * @param key Char pointer to key
+ * @return void* to value, NULL if not found
+ */
+void* CMapGet(ConcurrentHashMap* map, char* key) {
+    return CMapGetHashed(map, key, Hash(key));
+}
+
+/**
+ * @brief Get value of key value pair whose hash is already known
+ *
+ * @param map Pointer to ConcurrentHashMap
+ * @param key Char pointer to key
+ * @param hash size_t Hash(key)
+ * @return void* to value, NULL if not found. A later CMapPut of a value of
+ * the same size overwrites it in place, CMapGetCopy reads it safely.
+ */
+void* CMapGetHashed(ConcurrentHashMap* map, char* key, size_t hash) {
+    MapShard* shard = cmap_shard(map, hash);
+
+    for (;;) {
+        unsigned int seq = __atomic_load_n(&shard->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+        // memory a writer drops is retired, so this never reads freed memory
+        void* value = MapGetHashed(shard->map, key, hash);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shard->seq, __ATOMIC_RELAXED) == seq) {
+            return value;
+        }
+    }
+}
+
+/**
+ * @brief Copies the value of `key` out, retrying while a writer changes it,
+ * so that values updated in place are never seen half written
+ *
+ * @param map Pointer to ConcurrentHashMap
+ * @param key Char pointer to key
+ * @param out Void pointer receiving the value
+ * @param size int bytes `out` has room for
+ * @return int bytes of the value, which may be more than were copied, -1 if
+ * not found
+ */
+int CMapGetCopy(ConcurrentHashMap* map, char* key, void* out, int size) {
+    size_t hash = Hash(key);
+    MapShard* shard = cmap_shard(map, hash);
+
+    for (;;) {
+        unsigned int seq = __atomic_load_n(&shard->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+        MapPair* pair = map_lookup(shard->map, key, hash);
+        void* value = NULL;
+        int value_size = -1;
+        if (pair != NULL) {
+            value = __atomic_load_n(&pair->value, __ATOMIC_ACQUIRE);
+            value_size = __atomic_load_n(&pair->value_size, __ATOMIC_RELAXED);
+        }
+        // value and value_size belong together only if nothing was written
+        // meanwhile, check before copying so the copy stays in bounds
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shard->seq, __ATOMIC_RELAXED) != seq) continue;
+        if (value == NULL) return -1;
+        map_value_load(out, value, value_size < size ? value_size : size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shard->seq, __ATOMIC_RELAXED) == seq) {
+            return value_size;
+        }
+    }
+}
+
+/**
+ * @brief Adds `delta` to the int value of `key`, inserting it as `delta`
+ * when missing. Existing counters are bumped in place, so readers never see a
+ * half written value and the shard stays readable.
+ *
+ * @param map Pointer to ConcurrentHashMap
+ * @param key Char pointer to key
+ * @param delta int to add
+ * @return int the new value
+ */
+int CMapAddInt(ConcurrentHashMap* map, char* key, int delta) {
+    return CMapAddIntHashed(map, key, Hash(key), delta);
+}
+
+/**
+ * @brief CMapAddInt for a key whose hash is already known. Like MapAddInt
+ * the value stops at INT_MAX or INT_MIN.
+ *
+ * @param map Pointer to ConcurrentHashMap
+ * @param key Char pointer to key
+ * @param hash size_t Hash(key)
+ * @param delta int to add
+ * @return int the new value
+ */
+int CMapAddIntHashed(ConcurrentHashMap* map, char* key, size_t hash,
+                     int delta) {
+    MapShard* shard = cmap_shard(map, hash);
+    int result = delta;
+
+    pthread_mutex_lock(&shard->lock);
+    MapPair* pair = map_lookup(shard->map, key, hash);
+    if (pair != NULL) {
+        // writers hold the lock, readers load the value without it
+        int* value = (int*)pair->value;
+        result = map_add_saturated(__atomic_load_n(value, __ATOMIC_RELAXED),
+                                   delta);
+        __atomic_store_n(value, result, __ATOMIC_RELAXED);
+    } else {
+        // only inserting changes the table under readers
+        __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        MapPutHashed(shard->map, key, hash, &delta, sizeof(int));
+        __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+/**
+ * @brief Get size of the map, summed over the shards
+ *
+ * @param map Pointer to ConcurrentHashMap
+ * @return size_t of map size
+ */
+size_t CMapSize(ConcurrentHashMap* map) {
+    size_t size = 0;
+    for (size_t i = 0; i < map->num_shards; i++) {
+        size += __atomic_load_n(&map->shards[i].map->size, __ATOMIC_RELAXED);
+    }
+    return size;
+}
+
+/**
+ * @brief Frees the map, no other thread may be using it
+ *
+ * @param map Pointer to ConcurrentHashMap
+ */
+void CMapFree(ConcurrentHashMap* map) {
+    for (size_t i = 0; i < map->num_shards; i++) {
+        pthread_mutex_destroy(&map->shards[i].lock);
+        MapFree(map->shards[i].map);
+    }
+    free(map->shards);
+    free(map);
 }
 
 void debug_print_hashmap(HashMap* hashmap) {
+    MapTable* table = hashmap->table;
     printf("********************************************\n");
     printf("HashMap:\n");
     printf("Address:\t\tIndex:\t\tMapPair\n");
-    for (int i = 0; i < hashmap->capacity; i++) {
-        printf("%p\t\t%d", &(hashmap->contents[i]), i);
-        if (hashmap->contents[i] == 0) {
+    for (int i = 0; i < table->capacity; i++) {
+        printf("%p\t\t%d", &(table->contents[i]), i);
+        if (table->ctrl[i] == MAP_CTRL_EMPTY) {
             printf("\t\t0\n");
         } else {
             // print MapPair
-            printf("\t\t(%s, %d)\n", hashmap->contents[i]->key,
-                   *(int*)hashmap->contents[i]->value);
+            printf("\t\t(%s, %d)\n", table->contents[i]->key,
+                   *(int*)table->contents[i]->value);
         }
     }
     printf("********************************************\n");
-}
\ No newline at end of file
+}
@@ -1,30 +1,100 @@
 #ifndef __hashmap_h__
 #define __hashmap_h__
+#include <pthread.h>
+
+#include "hash.h"
 #include "stddef.h"
 
-#define MAP_INIT_CAPACITY 11
+// capacities are powers of two, slots are probed in groups of 16
+#define MAP_INIT_CAPACITY 16
+#define MAP_GROUP_WIDTH 16
+// control byte of an unused slot, used slots hold 7 bits of their hash
+#define MAP_CTRL_EMPTY 0x80
+// keys shorter than this and values up to 8 bytes are stored in the pair
+#define MAP_INLINE_KEY_SIZE 16
+// ConcurrentHashMap has 1 << CMAP_SHARD_BITS shards
+#define CMAP_SHARD_BITS 6
 
+// pairs never move once inserted, updates rewrite them in place
 typedef struct {
     char* key;
     void* value;
+    int value_size;
     int marked;
+    long long inline_value;
+    char inline_key[MAP_INLINE_KEY_SIZE];
 } MapPair;
 
+// all arrays of a table live in one allocation so that a resize swaps
+// them with a single pointer store
 typedef struct {
-    MapPair** contents;
     size_t capacity;
+    unsigned char* ctrl;  // one control byte per slot
+    size_t* hashes;       // full hash of every used slot
+    MapPair** contents;
+} MapTable;
+
+typedef struct {
+    MapTable* table;
     size_t size;
+    // with deferred_free set, memory readers may still be looking at is
+    // kept here until MapFree instead of being freed right away. Only
+    // resizes and values changing size retire anything.
+    int deferred_free;
+    void** retired;
+    size_t num_retired;
+    size_t retired_capacity;
 } HashMap;
 
+typedef struct {
+    pthread_mutex_t lock;  // serializes writers
+    unsigned int seq;      // odd while a writer is changing the shard
+    HashMap* map;
+} MapShard;
+
+// HashMap split into independently locked shards. Writers to different
+// shards never wait on each other and readers never take a lock.
+typedef struct {
+    MapShard* shards;
+    size_t num_shards;
+} ConcurrentHashMap;
+
 // External Functions
 HashMap* MapInit(void);
 void MapPut(HashMap* map, char* key, void* value, int value_size);
 void* MapGet(HashMap* map, char* key);
+size_t Hash(char* key);
+// *Hashed variants take Hash(key), e.g. MR_CurrentKeyHash() in a reducer
+void MapPutHashed(HashMap* map, char* key, size_t hash, void* value,
+                  int value_size);
+void* MapGetHashed(HashMap* map, char* key, size_t hash);
+// adds to an int value, saturating at INT_MAX and INT_MIN
+int MapAddInt(HashMap* map, char* key, int delta);
 size_t MapSize(HashMap* map);
+void MapFree(HashMap* map);
+
+ConcurrentHashMap* CMapInit(void);
+void CMapPut(ConcurrentHashMap* map, char* key, void* value, int value_size);
+void* CMapGet(ConcurrentHashMap* map, char* key);
+int CMapAddInt(ConcurrentHashMap* map, char* key, int delta);
+void CMapPutHashed(ConcurrentHashMap* map, char* key, size_t hash, void* value,
+                   int value_size);
+void* CMapGetHashed(ConcurrentHashMap* map, char* key, size_t hash);
+int CMapGetCopy(ConcurrentHashMap* map, char* key, void* out, int size);
+int CMapAddIntHashed(ConcurrentHashMap* map, char* key, size_t hash,
+                     int delta);
+size_t CMapSize(ConcurrentHashMap* map);
+void CMapFree(ConcurrentHashMap* map);
 
 // Internal Functions
 int resize_map(HashMap* map);
-size_t Hash(char* key, size_t capacity);
+void map_release(HashMap* map, void* ptr);
+MapTable* map_table_init(size_t capacity);
+void map_value_load(void* out, void* value, size_t size);
+void map_value_store(void* value, void* in, size_t size);
+size_t map_find(MapTable* table, char* key, size_t hash);
+MapPair* map_lookup(HashMap* map, char* key, size_t hash);
+int map_add_saturated(int value, int delta);
 
 // DEBUG
 void debug_print_hashmap(HashMap* hashmap);
@@ -0,0 +1,103 @@
+#include "input.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Maps bytes [offset, offset + length) of a file for reading line by
+ * line, with read-ahead tuned for a single sequential pass
+ *
+ * @param in Pointer to MR_Input to fill
+ * @param file_name Char pointer to file name
+ * @param offset long first byte of the range
+ * @param length long bytes in the range, -1 for the rest of the file
+ * @return int 0 for success, -1 if the file cannot be mapped
+ */
+int MR_InputOpen(MR_Input* in, char* file_name, long offset, long length) {
+    struct stat st;
+    int fd = open(file_name, O_RDONLY);
+
+    memset(in, 0, sizeof(MR_Input));
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        printf("Cannot open %s! %s\n", file_name, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    if (length < 0 || offset + length > st.st_size) {
+        length = st.st_size > offset ? st.st_size - offset : 0;
+    }
+    if (length == 0) {
+        close(fd);
+        return 0;
+    }
+
+    // mmap offsets have to be page aligned
+    long start = offset & ~(sysconf(_SC_PAGESIZE) - 1);
+    in->map_length = offset - start + length;
+    in->map = mmap(NULL, in->map_length, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                   fd, start);
+    close(fd);
+    if (in->map == MAP_FAILED) {
+        printf("Mmap error! %s\n", strerror(errno));
+        in->map = NULL;
+        return -1;
+    }
+    madvise(in->map, in->map_length, MADV_SEQUENTIAL);
+
+    in->data = (char*)in->map + (offset - start);
+    in->length = length;
+    return 0;
+}
+
+/**
+ * @brief Hands out the next line of the input, without copying it
+ *
+ * @param in Pointer to MR_Input
+ * @param len Pointer receiving the line length, without its newline
+ * @return char* start of the line, NULL at the end of the input. line[len]
+ * is the newline (or a NUL), so it may be overwritten to end the string.
+ */
+char* MR_InputNextLine(MR_Input* in, size_t* len) {
+    if (in->pos >= in->length) {
+        return NULL;
+    }
+
+    char* line = in->data + in->pos;
+    char* nl = memchr(line, '\n', in->length - in->pos);
+    if (nl != NULL) {
+        *len = nl - line;
+        in->pos += *len + 1;
+        return line;
+    }
+
+    // the byte after the mapping may not exist, so the last line is copied
+    *len = in->length - in->pos;
+    in->pos = in->length;
+    in->tail = (char*)malloc(*len + 1);
+    if (in->tail == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    memcpy(in->tail, line, *len);
+    in->tail[*len] = '\0';
+    return in->tail;
+}
+
+/**
+ * @brief Unmaps the input, lines handed out are no longer valid
+ *
+ * @param in Pointer to MR_Input
+ */
+void MR_InputClose(MR_Input* in) {
+    if (in->map != NULL) {
+        munmap(in->map, in->map_length);
+    }
+    free(in->tail);
+    memset(in, 0, sizeof(MR_Input));
+}
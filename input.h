@@ -0,0 +1,22 @@
+#ifndef __input_h__
+#define __input_h__
+#include "stddef.h"
+
+// Memory-mapped view of a file or of one RangeMapper range. The mapping is
+// private and writable, so a mapper may cut lines into strings in place;
+// the pages it writes are copied by the kernel, the file never changes.
+typedef struct {
+    char* data;  // first byte of the range
+    size_t length;
+    size_t pos;  // start of the next line
+    void* map;   // page aligned mapping holding the range
+    size_t map_length;
+    char* tail;  // NUL terminated copy of an unterminated last line
+} MR_Input;
+
+// External Functions
+int MR_InputOpen(MR_Input* in, char* file_name, long offset, long length);
+char* MR_InputNextLine(MR_Input* in, size_t* len);
+void MR_InputClose(MR_Input* in);
+
+#endif  // __input_h__
@@ -1,44 +1,67 @@
-#include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "hashmap.h"
+#include "input.h"
 #include "mapreduce.h"
 
-HashMap *hashmap;
+// written by every reducer thread at once
+ConcurrentHashMap *hashmap;
 
-void Map(char *file_name) {
-    FILE *fp = fopen(file_name, "r");
-    assert(fp != NULL);
+void MapLine(char *line, size_t len) {
+    MR_Tokenizer tokenizer;
+    char *token;
+    size_t token_len;
 
-    char *line = NULL;
-    size_t size = 0;
-    while (getline(&line, &size, fp) != -1) {
-        char *token, *dummy = line;
-        while ((token = strsep(&dummy, " \t\n\r")) != NULL) {
-            if (!strcmp(token, "")) break;
+    MR_TokenizerInit(&tokenizer, line, len);
+    while ((token = MR_NextToken(&tokenizer, &token_len)) != NULL) {
+        // the byte after a token is a delimiter or line[len], both writable
+        token[token_len] = '\0';
+        MR_EmitInt(token, 1);
+    }
+}
 
-            MR_Emit(token, "1");
-        }
+void MapRange(char *file_name, long offset, long length) {
+    MR_Input in;
+    // MR_InputOpen has already said why
+    if (MR_InputOpen(&in, file_name, offset, length) != 0) exit(1);
+
+    // lines are tokenized where they sit in the mapped file, no copies
+    char *line;
+    size_t len;
+    while ((line = MR_InputNextLine(&in, &len)) != NULL) {
+        MapLine(line, len);
     }
-    free(line);
-    fclose(fp);
+    MR_InputClose(&in);
+}
+
+void Map(char *file_name) { MapRange(file_name, 0, -1); }
+
+void Combine(char *key, Getter get_next, int partition_number) {
+    // collapse this mapper's partial counts into a single pair
+    long count = 0, value;
+
+    while (MR_GetInt(get_next, key, partition_number, &value)) count += value;
+
+    MR_EmitInt(key, count);
 }
 
 void Reduce(char *key, Getter get_next, int partition_number) {
     // HashMap take a (void *) as value
     // printf("Here for key %s\n", key);
-    int *count = (int *)malloc(sizeof(int));
-    *count = 0;
-    char *value;
+    // the map stores int counts, so sum into one
+    int count = 0;
+    long value;
 
-    while ((value = get_next(key, partition_number)) != NULL) (*count)++;
+    // values are partial counts once the combiner has run
+    while (MR_GetInt(get_next, key, partition_number, &value)) count += value;
 
-    // printf("count = %d\n", *count);
+    // printf("count = %d\n", count);
 
-    MapPut(hashmap, key, count, sizeof(int));
+    // the key was hashed once at emit time, no need to do it again
+    CMapAddIntHashed(hashmap, key, MR_CurrentKeyHash(), count);
 }
 
 /* This program accepts a list of files and stores their words and
@@ -52,17 +75,27 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    hashmap = MapInit();
+    hashmap = CMapInit();
     // save the searchterm
     char *searchterm = argv[argc - 1];
     argc -= 1;
 
     // run mapreduce
-    MR_Run(argc, argv, Map, 1, Reduce, 1, MR_DefaultHashPartition);
+    MR_Options options = {0};
+    options.combine = Combine;
+    // small splits so that even file1m.txt keeps every mapper busy
+    options.map_range = MapRange;
+    options.split_size = 256 * 1024;
+    // sort and merge while mapping instead of after it
+    options.pipeline = 1;
+    // fine-grained partitions shared by the 4 reducers
+    options.num_partitions = MR_AUTO_PARTITIONS;
+    MR_RunWithOptions(argc, argv, Map, 4, Reduce, 4, MR_DefaultHashPartition,
+                      &options);
     // get the number of occurrences and print
     // debug_print_hashmap(hashmap);
     char *result;
-    if ((result = MapGet(hashmap, searchterm)) != NULL) {
+    if ((result = CMapGet(hashmap, searchterm)) != NULL) {
         printf("Found %s %d times\n", searchterm, *(int *)result);
     } else {
         printf("Word not found!\n");
@@ -6,40 +6,503 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-#include "hashmap.h"
+#include "arena.h"
+#include "hash.h"
+#include "scheduler.h"
+#include "sketch.h"
+#include "stats.h"
+#include "topology.h"
+
+// bytes of records a segment holds, mappers hand over whole segments
+#define SEGMENT_SIZE (64 * 1024)
+// number of keys each mapper samples for MR_RangePartition
+#define SAMPLE_SIZE 1024
+// partitions smaller than this are always sorted by a single thread
+#define PARALLEL_SORT_MIN (64 * 1024)
+// initial number of slots of a hash grouping table, a power of two
+#define GROUP_TABLE_INIT_CAPACITY 1024
+// byte range handed to each RangeMapper call unless split_size says otherwise
+#define DEFAULT_SPLIT_SIZE (16 * 1024 * 1024)
+// hash grouped partitions are reduced in tasks of about this many records
+#define REDUCE_TASK_SIZE (16 * 1024)
+// partitions per online core with MR_AUTO_PARTITIONS
+#define PARTITIONS_PER_CORE 8
+// buffer sizes used to write spilled runs and to read them back
+#define SPILL_WRITE_SIZE (1024 * 1024)
+#define SPILL_READ_SIZE (64 * 1024)
+// mappers past options.memory_budget by more than 1 / SPILL_MARGIN of it
+// wait for the spiller instead of going on
+#define SPILL_MARGIN 8
 
 // new structs
 typedef struct {
-    MapPair** pairs;
+    unsigned long hash;    // HashBytes of the key, computed once by MR_Emit
+    unsigned int key_len;  // lengths without the NUL terminators
+    unsigned int value_len;
+    // followed by the key, its NUL, the value and its NUL
+} Record;
+
+typedef struct Segment {
+    struct Segment* next;
+    size_t capacity;  // bytes available in data
+    size_t used;
+    size_t count;  // number of records
+    char data[];
+} Segment;
+
+typedef struct {
+    unsigned long prefix;  // first key bytes, compares like memcmp
+    Record* record;
+} IndexEntry;
+
+typedef struct Run {
+    struct Run* next;
+    IndexEntry* index;  // sorted entries of some of the partition's records
     size_t size;
-    size_t capacity;
+    int level;  // number of merges that went into the run
+} Run;
+
+typedef struct {
+    off_t offset;  // bytes [offset, end) of the partition's spill file
+    off_t end;
+} SpillRun;
+
+typedef struct {
+    Segment* segments;  // records of the partition, in no particular order
+    Segment* open;      // segment taking single records from InterMapPut
+    size_t size;        // number of records
+    size_t bytes;
+    IndexEntry* index;  // one entry per record, built for sorting
+    // pipeline mode: sorted runs waiting for a merge partner, and the
+    // InterMapPut segments no run covers yet
+    Run* runs;
+    Segment* loose;
+    // sorted runs written out once the memory budget was exceeded
+    SpillRun* spills;
+    int num_spills;
+    int spill_fd;
+    size_t spilled;  // number of records on disk
+    int node;        // NUMA node of the records and of the thread reducing
     sem_t sem;
-} ArrayList;
+} Partition;
 
 typedef struct {
-    ArrayList** contents;
+    Partition** contents;
     size_t capacity;
     size_t size;
 } InterHashMap;
 
+typedef struct {
+    char* key;
+    size_t bytes;   // key and value length of the sampled pair
+    double weight;  // number of emitted pairs this sample stands for
+} Sample;
+
+typedef struct {
+    unsigned long hash;
+    size_t first;  // index entry of the first record with this key
+    size_t count;  // records with this key, then where the group goes
+} Group;
+
+typedef struct {
+    Segment** buffers;  // one private open segment per partition
+    int num_partitions;
+    Segment** spare;      // emptied segments ready for reuse, by node
+    IndexEntry* scratch;  // index used while combining a segment
+    IndexEntry* grouped;  // scratch regrouped by hash, MR_GROUP_HASH only
+    size_t scratch_capacity;
+    // range partitioning holds records here until the split points are known
+    int staging;
+    Segment* staged;
+    Segment* staged_open;
+    Sample* samples;
+    size_t num_samples;
+    size_t seen;
+    unsigned long seed;
+} EmitBuffers;
+
+typedef struct {
+    char* file;
+    long offset;
+    long length;
+} MapTask;
+
 typedef struct {
     Mapper map;
-    int curr;
-    int numfiles;
-    char** files;
+    RangeMapper map_range;  // set when the inputs are split into ranges
+    int numtasks;
+    MapTask* tasks;
 } MapThreadArgs;
 
 typedef struct {
     Reducer reduce;
     int partition_number;
-} ReduceThreadArgs;
+    size_t lo, hi;  // entries [lo, hi) of the partition's index
+    size_t weight;  // records to reduce, spilled ones included
+    int node;       // that of the partition
+} ReduceTask;
+
+// Reads one sorted run back record by record, from the spill file or from
+// the in-memory index of the partition
+typedef struct {
+    IndexEntry head;  // current record, head.record is NULL at the end
+    int fd;           // spill file, -1 for the in-memory run
+    off_t pos, end;   // bytes of the run not read into buf yet
+    char* buf;
+    size_t buf_size, buf_len, buf_pos;
+    IndexEntry* index;  // in-memory run
+    size_t i, n;
+} RunReader;
+
+// k-way merge of a spilled partition's runs, a heap ordered by head
+typedef struct {
+    RunReader** heap;
+    int n;
+    RunReader* taken;  // reader whose head was handed out last
+    IndexEntry current;  // copy of the first record of the current key
+    size_t current_size;
+} MergeState;
+
+typedef struct {
+    IndexEntry* index;  // sorted run being reduced
+    size_t pos;         // next value handed out by get_func
+    size_t end;         // one past the last record of the current key
+    Record* record;     // first record of the current key
+    MergeState* merge;  // set when the values come from a k-way merge
+    size_t value_len;   // length of the value get_func returned last
+} Cursor;
+
+typedef enum { SORT_INDEX, SORT_RUN, SORT_MERGE } SortTaskKind;
+
+typedef struct {
+    SortTaskKind kind;
+    Partition* partition;
+    IndexEntry* src;
+    IndexEntry* dst;
+    size_t lo, mid, hi;     // runs [lo, mid) and [mid, hi) of src
+    size_t out_lo, out_hi;  // the slice of the merged output to produce
+    int split;              // SORT_INDEX leaves the sorting to SORT_RUN
+} SortTask;
+
+typedef struct {
+    IndexEntry* src;  // runs being merged
+    IndexEntry* dst;  // where the next level of merges goes
+    size_t* bounds;   // runs[i] is [bounds[i], bounds[i + 1])
+    int runs;
+} SortState;
+
+typedef struct {
+    Segment* output;  // records emitted by the combiner
+    EmitBuffers* eb;
+    int node;  // where the output segments go
+} CombineState;
+
+typedef struct {
+    Partition* partition;
+    Run* a;
+    Run* b;
+} MergeTask;
+
+// Everything a job needs. Workers, arenas and partitions outlive the job and
+// are reset for the next one run on the same context.
+struct MR_Context {
+    // runs the map, sort and reduce tasks, kept from job to job
+    Scheduler* scheduler;
+    // where the workers run when pinned, NULL otherwise
+    Topology* topology;
+    // nodes the records are spread over, 1 unless the workers are pinned
+    int num_nodes;
+    // num_nodes per worker, one for each node the worker stores records on,
+    // rewound after every job instead of unmapped
+    Arena** workerarenas;
+    // unique among all contexts, tells the arenas of other threads apart
+    int job;
+    // reused while the number of partitions stays the same
+    InterHashMap* interhashmap;
+    MapThreadArgs* mapthreadargs;
+    // next map task for mapper_task to take, when fewer workers map
+    int next_maptask;
+    MR_Options options;
+    Partitioner partitioner;
+    // set when mappers hand over sorted runs that are merged during the map
+    // phase
+    int pipeline;
+    // record bytes held by the partitions and segment bytes held in the
+    // mappers' private buffers, together kept under options.memory_budget
+    size_t inmemory;
+    size_t buffered;
+    // set when the job collects stats, and lock waits summed up in
+    // nanoseconds
+    int collectstats;
+    unsigned long lockwait;
+    MR_Stats stats;
+    // one thread spills at a time, the others keep mapping unless they are
+    // well over the budget
+    pthread_mutex_t spilllock;
+    // segments emptied by a spill, reused before new ones are allocated,
+    // by node
+    Segment** freesegments;
+    pthread_mutex_t segmentlock;
+    // emit buffers of each worker, map tasks use the one of their worker
+    EmitBuffers** workerbuffers;
+    // sketch of each worker while MR_ContextRunSketch runs, NULL otherwise
+    MR_Sketch** workersketches;
+    // reduce tasks of the current job by node, biggest first, and for each
+    // node the next one to take and one past its last
+    ReduceTask* reducetasks;
+    size_t num_reducetasks;
+    size_t* next_reducetask;
+    size_t* end_reducetask;
+    // tasks of the current sort round
+    SortTask* sorttasks;
+    size_t num_sorttasks;
+    // pooled key samples and the split points chosen from them
+    Sample* samples;
+    size_t num_samples;
+    char** splitpoints;
+    // arenas of threads outside the pool, freed when the job ends
+    Arena** arenas;
+    int num_arenas;
+    pthread_mutex_t arenalock;
+};
+
+// number of jobs started by any context
+int jobs;
+// context of the job the calling thread works for
+__thread MR_Context* ctx;
+// pairs the thread emitted in the running map task, added to stats after it
+__thread size_t threadrecords;
+__thread size_t threadbytes;
+// private to each thread that stores intermediate records
+__thread Arena* threadarena;
+__thread int threadarena_job;
+// the running worker's buffers while a map task runs, NULL otherwise
+__thread EmitBuffers* emitbuffers;
+// or its sketch, when the job only counts keys
+__thread MR_Sketch* threadsketch;
+// set while a map task runs the combiner
+__thread CombineState* combinestate;
+// values of the key the calling thread is reducing or combining
+__thread Cursor* cursor;
+
+int cmp(const void* a, const void* b);
+void ReduceIndex(IndexEntry* index, size_t size, Reducer reduce,
+                 int partition_number);
+void GroupIndex(IndexEntry* index, IndexEntry* out, size_t size);
+int PartitionOf(unsigned long hash, char* key, int num_partitions);
+Arena* ThreadArena(int node);
+Run* RunInit(Segment* chain, size_t size);
+void SpillIfOverBudget(void);
+void PartitionAddRun(Partition* partition, Run* run);
+void merge_task(void* arg);
+void ContextRun(MR_Context* context, int argc, char* argv[], Mapper map,
+                int num_mappers, Reducer reduce, int num_reducers,
+                Partitioner partition, MR_Options* opts);
+
+/**
+ * @brief Bytes taken by a record, padded so the next one stays aligned
+ *
+ * @param key_len size_t key length without NUL
+ * @param value_len size_t value length without NUL
+ * @return size_t record size
+ */
+size_t RecordSize(size_t key_len, size_t value_len) {
+    return (sizeof(Record) + key_len + value_len + 2 + 7) & ~(size_t)7;
+}
+
+char* RecordKey(Record* record) { return (char*)(record + 1); }
+
+char* RecordValue(Record* record) {
+    return (char*)(record + 1) + record->key_len + 1;
+}
+
+/**
+ * @brief Packs the first key bytes big-endian so that comparing prefixes
+ * orders keys the same way memcmp does
+ *
+ * @param key char* of key
+ * @param key_len size_t key length
+ * @return unsigned long prefix
+ */
+unsigned long KeyPrefix(const char* key, size_t key_len) {
+    unsigned long prefix = 0;
+    size_t n = key_len < sizeof(prefix) ? key_len : sizeof(prefix);
+    for (size_t i = 0; i < n; i++) {
+        prefix |= (unsigned long)(unsigned char)key[i]
+                  << (8 * (sizeof(prefix) - 1 - i));
+    }
+    return prefix;
+}
+
+/**
+ * @brief NUMA node the calling thread runs on, 0 unless the workers are
+ * pinned
+ *
+ * @return int node number
+ */
+int ThreadNode(void) {
+    int id = SchedulerWorkerId();
+    return ctx->topology != NULL && id >= 0 ? ctx->topology->nodes[id] : 0;
+}
+
+/**
+ * @brief Initializes an empty Segment with room for at least `size` bytes,
+ * reusing a spare one when possible
+ *
+ * @param eb Pointer to EmitBuffers holding spare segments, may be NULL
+ * @param size size_t bytes the segment must fit
+ * @param node int NUMA node to place the segment on, -1 for the caller's
+ * @return Segment* Pointer to Segment
+ */
+Segment* SegmentInit(EmitBuffers* eb, size_t size, int node) {
+    Segment* seg = NULL;
+    size_t capacity = size > SEGMENT_SIZE ? size : SEGMENT_SIZE;
+
+    if (node < 0) node = ThreadNode();
+    if (eb != NULL && eb->spare[node] != NULL && capacity == SEGMENT_SIZE) {
+        seg = eb->spare[node];
+        eb->spare[node] = seg->next;
+    } else if (capacity == SEGMENT_SIZE &&
+               __atomic_load_n(&ctx->freesegments[node], __ATOMIC_RELAXED) !=
+                   NULL) {
+        // left behind by a spill, the peek above skips the lock when the
+        // list is empty and is checked again under it
+        pthread_mutex_lock(&ctx->segmentlock);
+        seg = ctx->freesegments[node];
+        if (seg != NULL) {
+            __atomic_store_n(&ctx->freesegments[node], seg->next,
+                             __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&ctx->segmentlock);
+    }
+    if (seg == NULL) {
+        seg = (Segment*)ArenaAlloc(ThreadArena(node),
+                                   sizeof(Segment) + capacity);
+        seg->capacity = capacity;
+    }
+    seg->next = NULL;
+    seg->used = 0;
+    seg->count = 0;
+    return seg;
+}
 
-InterHashMap* interhashmap;
-MapThreadArgs* mapthreadargs;
-ReduceThreadArgs* reducethreadargs;
-HashMap* freq;
-pthread_mutex_t mlock;
+/**
+ * @brief Keeps an emptied segment around for SegmentInit
+ *
+ * @param eb Pointer to EmitBuffers
+ * @param seg Pointer to Segment
+ * @param node int NUMA node the segment was placed on, -1 for the caller's
+ */
+void SegmentRecycle(EmitBuffers* eb, Segment* seg, int node) {
+    if (node < 0) node = ThreadNode();
+    // oversized segments are left to the arena
+    if (seg->capacity == SEGMENT_SIZE) {
+        seg->next = eb->spare[node];
+        eb->spare[node] = seg;
+    }
+}
+
+int SegmentFits(Segment* seg, size_t key_len, size_t value_len) {
+    return seg->used + RecordSize(key_len, value_len) <= seg->capacity;
+}
+
+/**
+ * @brief Appends a record to a segment that has room for it
+ *
+ * @param seg Pointer to Segment
+ * @param hash unsigned long hash of key
+ * @param key Char pointer to key
+ * @param key_len size_t key length
+ * @param value Char pointer to value
+ * @param value_len size_t value length
+ */
+void SegmentPut(Segment* seg, unsigned long hash, char* key, size_t key_len,
+                char* value, size_t value_len) {
+    Record* record = (Record*)(seg->data + seg->used);
+
+    record->hash = hash;
+    record->key_len = key_len;
+    record->value_len = value_len;
+    // MR_EmitBytes data need not be NUL terminated, records always are
+    memcpy(RecordKey(record), key, key_len);
+    RecordKey(record)[key_len] = '\0';
+    memcpy(RecordValue(record), value, value_len);
+    RecordValue(record)[value_len] = '\0';
+    seg->used += RecordSize(key_len, value_len);
+    seg->count += 1;
+}
+
+/**
+ * @brief Fills `index` with one entry per record of the segment
+ *
+ * @param seg Pointer to Segment
+ * @param index Pointer to at least seg->count IndexEntry
+ * @return size_t number of entries written
+ */
+size_t SegmentIndex(Segment* seg, IndexEntry* index) {
+    size_t n = 0;
+    char* p = seg->data;
+
+    while (p < seg->data + seg->used) {
+        Record* record = (Record*)p;
+        index[n].prefix = KeyPrefix(RecordKey(record), record->key_len);
+        index[n].record = record;
+        n++;
+        p += RecordSize(record->key_len, record->value_len);
+    }
+    return n;
+}
+
+/**
+ * @brief Initializes Partition
+ *
+ * @return Partition*
+ */
+Partition* PartitionInit(void) {
+    Partition* partition = (Partition*)calloc(1, sizeof(Partition));
+    sem_init(&partition->sem, 0, 1);
+    return partition;
+}
+
+/**
+ * @brief Locks a partition, timing the wait when stats are collected
+ *
+ * @param partition Pointer to Partition
+ */
+void PartitionLock(Partition* partition) {
+    if (!ctx->collectstats) {
+        sem_wait(&partition->sem);
+        return;
+    }
+    if (sem_trywait(&partition->sem) == 0) return;
+    double start = StatsWallTime();
+    sem_wait(&partition->sem);
+    __atomic_add_fetch(&ctx->lockwait,
+                       (unsigned long)((StatsWallTime() - start) * 1e9),
+                       __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Builds the partition's index from its segments, sized exactly so
+ * it never has to grow
+ *
+ * @param partition Pointer to Partition
+ */
+void PartitionIndex(Partition* partition) {
+    size_t n = 0;
+
+    partition->index =
+        (IndexEntry*)malloc(sizeof(IndexEntry) * partition->size);
+    if (partition->index == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    for (Segment* seg = partition->segments; seg != NULL; seg = seg->next) {
+        n += SegmentIndex(seg, partition->index + n);
+    }
+}
 
 /**
  * @brief Initializes HashMap
@@ -48,388 +511,2184 @@ pthread_mutex_t mlock;
  */
 InterHashMap* InterMapInit(int capacity) {
     InterHashMap* interhashmap = (InterHashMap*)malloc(sizeof(InterHashMap));
-    interhashmap->contents = (ArrayList**)calloc(capacity, sizeof(ArrayList*));
+    interhashmap->contents = (Partition**)calloc(capacity, sizeof(Partition*));
     interhashmap->capacity = capacity;
     interhashmap->size = 0;
 
+    // partitions are created up front so mappers never race to create them.
+    // With pinned workers they are dealt out like the workers, so every
+    // node holds and reduces its share.
+    for (int i = 0; i < capacity; i++) {
+        interhashmap->contents[i] = PartitionInit();
+        if (ctx->topology != NULL) {
+            interhashmap->contents[i]->node =
+                ctx->topology->nodes[i % ctx->topology->num_workers];
+        }
+    }
+
     return interhashmap;
 }
 
 /**
- * @brief Initializes MapThreadArgs
+ * @brief Empties every partition for the next job (the records live in
+ * arenas)
+ *
+ * @param interhashmap Pointer to InterHashMap
+ */
+void InterMapReset(InterHashMap* interhashmap) {
+    for (int i = 0; i < interhashmap->capacity; i++) {
+        Partition* partition = interhashmap->contents[i];
+        // the spill file was unlinked when created, closing it removes it
+        if (partition->num_spills != 0) {
+            close(partition->spill_fd);
+        }
+        free(partition->spills);
+        free(partition->index);
+        // the semaphore stays, it must not be copied
+        partition->segments = NULL;
+        partition->open = NULL;
+        partition->size = 0;
+        partition->bytes = 0;
+        partition->index = NULL;
+        partition->runs = NULL;
+        partition->loose = NULL;
+        partition->spills = NULL;
+        partition->num_spills = 0;
+        partition->spilled = 0;
+    }
+    interhashmap->size = 0;
+}
+
+/**
+ * @brief Frees the HashMap and its partitions
+ *
+ * @param interhashmap Pointer to InterHashMap
+ */
+void InterMapFree(InterHashMap* interhashmap) {
+    InterMapReset(interhashmap);
+    for (int i = 0; i < interhashmap->capacity; i++) {
+        sem_destroy(&interhashmap->contents[i]->sem);
+        free(interhashmap->contents[i]);
+    }
+    free(interhashmap->contents);
+    free(interhashmap);
+}
+
+void MapTaskAdd(MapThreadArgs* mtarg, char* file, long offset, long length) {
+    mtarg->tasks = (MapTask*)realloc(mtarg->tasks,
+                                     sizeof(MapTask) * (mtarg->numtasks + 1));
+    mtarg->tasks[mtarg->numtasks].file = file;
+    mtarg->tasks[mtarg->numtasks].offset = offset;
+    mtarg->tasks[mtarg->numtasks].length = length;
+    mtarg->numtasks += 1;
+}
+
+/**
+ * @brief Cuts a file into ranges of about `split_size` bytes. Every range
+ * but the last is stretched to end right after a newline, so no line is
+ * ever split between two mappers.
+ *
+ * @param mtarg Pointer to MapThreadArgs receiving the tasks
+ * @param file Char pointer to file name
+ * @param split_size long target range size
+ */
+void MapTaskSplit(MapThreadArgs* mtarg, char* file, long split_size) {
+    FILE* fp = fopen(file, "r");
+    if (fp == NULL) {
+        printf("Cannot open %s! %s\n", file, strerror(errno));
+        return;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+
+    long start = 0;
+    while (start < size) {
+        long end = start + split_size;
+        if (end < size) {
+            int c;
+            fseek(fp, end - 1, SEEK_SET);
+            while ((c = fgetc(fp)) != EOF && c != '\n') continue;
+            end = ftell(fp);
+        } else {
+            end = size;
+        }
+        MapTaskAdd(mtarg, file, start, end - start);
+        start = end;
+    }
+    fclose(fp);
+}
+
+/**
+ * @brief Initializes MapThreadArgs with the job's map tasks, one per file or
+ * one per byte range when options.map_range is set
  *
  * @return MapThreadArgs* Pointer to MapThreadArgs
  */
 MapThreadArgs* MapThreadArgsInit(Mapper map, char** files, int numfiles) {
     MapThreadArgs* mtarg = (MapThreadArgs*)malloc(sizeof(MapThreadArgs));
     mtarg->map = map;
-    mtarg->curr = 0;
-    mtarg->numfiles = numfiles;
-    mtarg->files = files;
+    mtarg->map_range = ctx->options.map_range;
+    mtarg->numtasks = 0;
+    mtarg->tasks = NULL;
 
+    for (int i = 0; i < numfiles; i++) {
+        if (mtarg->map_range != NULL) {
+            MapTaskSplit(mtarg, files[i], ctx->options.split_size > 0
+                                              ? ctx->options.split_size
+                                              : DEFAULT_SPLIT_SIZE);
+        } else {
+            MapTaskAdd(mtarg, files[i], 0, -1);
+        }
+    }
     return mtarg;
 }
 
+void MapThreadArgsFree(MapThreadArgs* mtarg) {
+    free(mtarg->tasks);
+    free(mtarg);
+}
+
 /**
- * @brief Initializes ReduceThreadArgs
+ * @brief Initializes a mapper's private emit buffers
  *
- * @return ReduceThreadArgs* Pointer to ReduceThreadArgs
+ * @param num_partitions int number of partitions to buffer for
+ * @return EmitBuffers* Pointer to EmitBuffers
  */
-ReduceThreadArgs* ReduceThreadArgsInit(Reducer reduce, int partition_number) {
-    ReduceThreadArgs* rtarg =
-        (ReduceThreadArgs*)malloc(sizeof(ReduceThreadArgs));
-    rtarg->reduce = reduce;
-    rtarg->partition_number = partition_number;
+EmitBuffers* EmitBuffersInit(int num_partitions) {
+    EmitBuffers* eb = (EmitBuffers*)calloc(1, sizeof(EmitBuffers));
+    // segments are opened on the first record of each partition
+    eb->buffers = (Segment**)calloc(num_partitions, sizeof(Segment*));
+    eb->num_partitions = num_partitions;
+    eb->spare = (Segment**)calloc(ctx->num_nodes, sizeof(Segment*));
 
-    return rtarg;
+    if (ctx->partitioner == MR_RangePartition) {
+        eb->staging = 1;
+        eb->samples = (Sample*)malloc(sizeof(Sample) * SAMPLE_SIZE);
+    }
+    eb->seed = (unsigned long)eb | 1;
+    return eb;
 }
 
 /**
- * @brief Initializes ArrayList
+ * @brief Frees a mapper's private emit buffers (must be flushed first)
  *
- * @return ArrayList*
+ * @param eb Pointer to EmitBuffers
  */
-ArrayList* ArrayListInit(void) {
-    ArrayList* arraylist = malloc(sizeof(ArrayList));
-    arraylist->size = 0;
-    // Allocate the array
-    arraylist->pairs = (MapPair**)calloc(sizeof(MapPair*), 1);
-    arraylist->capacity = 1;
-    sem_init(&arraylist->sem, 0, 1);
-    return arraylist;
+void EmitBuffersFree(EmitBuffers* eb) {
+    free(eb->buffers);
+    free(eb->spare);
+    free(eb->scratch);
+    free(eb->grouped);
+    free(eb->samples);
+    free(eb);
 }
 
 /**
- * Allocate sufficient array capacity for at least `size` elements.
+ * @brief Gets the calling thread's arena for the current job, creating it
+ * on first use
+ *
+ * @param node int NUMA node the memory goes to, only workers tell them apart
+ * @return Arena* Pointer to the thread's Arena
  */
-void arraylist_allocate(ArrayList* l, unsigned int size) {
-    if (size > l->capacity) {
-        unsigned int new_capacity = l->capacity + 1;
-        l->pairs = realloc(l->pairs, sizeof(MapPair*) * new_capacity);
-        l->capacity = new_capacity;
+Arena* ThreadArena(int node) {
+    int id = SchedulerWorkerId();
+
+    // workers keep theirs from job to job
+    if (id >= 0) {
+        return ctx->workerarenas[id * ctx->num_nodes + node];
+    }
+    if (threadarena == NULL || threadarena_job != ctx->job) {
+        threadarena = ArenaInit(ctx->options.huge_pages);
+        threadarena_job = ctx->job;
+        pthread_mutex_lock(&ctx->arenalock);
+        ctx->arenas =
+            realloc(ctx->arenas, sizeof(Arena*) * (ctx->num_arenas + 1));
+        ctx->arenas[ctx->num_arenas++] = threadarena;
+        pthread_mutex_unlock(&ctx->arenalock);
     }
+    return threadarena;
 }
 
 /**
- * Add item at the end of the list.
+ * @brief Ends the current job's arenas in one go. Those of the workers are
+ * rewound for the next job, the others are freed.
  */
-void arraylist_add(ArrayList* l, MapPair* item) {
-    arraylist_allocate(l, l->size + 1);
-    l->pairs[l->size++] = item;
+void ArenasFree(void) {
+    for (int i = 0; i < ctx->scheduler->num_workers * ctx->num_nodes; i++) {
+        if (ctx->collectstats) {
+            // worker arenas outlive the job, only count what it took
+            ctx->stats.arena_bytes += ctx->workerarenas[i]->in_use;
+        }
+        ArenaReset(ctx->workerarenas[i]);
+    }
+    for (int i = 0; i < ctx->num_arenas; i++) {
+        if (ctx->collectstats) {
+            ctx->stats.arena_bytes += ctx->arenas[i]->in_use;
+        }
+        ArenaFree(ctx->arenas[i]);
+    }
+    free(ctx->arenas);
+    ctx->arenas = NULL;
+    ctx->num_arenas = 0;
+    // they were carved out of the arenas
+    memset(ctx->freesegments, 0, sizeof(Segment*) * ctx->num_nodes);
 }
 
 /**
  * @brief Inserts key value pair in hashmap
  *
  * @param interhashmap Pointer to interhashmap
+ * @param hash unsigned long hash of key
  * @param key Char pointer to key
- * @param value Void pointer to value
- * @param value_size int value of size of HashMap
+ * @param key_len size_t key length
+ * @param value Char pointer to value
+ * @param value_len size_t value length
  */
-void InterMapPut(InterHashMap* interhashmap, char* key, char* value) {
-    // initialize new kv pair and hash value
-    MapPair* newpair = (MapPair*)malloc(sizeof(MapPair));
-    int partition_number;
-
-    newpair->key = strdup(key);
-    newpair->value = strdup(value);
-    newpair->marked = 0;
-    partition_number = MR_DefaultHashPartition(key, interhashmap->capacity);
-    // printf("%s mapped to %d\n", newpair->key, h);
+void InterMapPut(InterHashMap* interhashmap, unsigned long hash, char* key,
+                 size_t key_len, char* value, size_t value_len) {
+    int partition_number = PartitionOf(hash, key, interhashmap->capacity);
+    Partition* partition = interhashmap->contents[partition_number];
 
-    // if ArrayList exists
-    if (interhashmap->contents[partition_number] != NULL) {
-        sem_wait(&(interhashmap->contents[partition_number]->sem));
-        arraylist_add(interhashmap->contents[partition_number], newpair);
-    } else {
-        // key not found in interhashmap, h is an empty slot
-        // add pair to interhashmap
-        // create new ArrayList*
-        ArrayList* new = ArrayListInit();
-        interhashmap->contents[partition_number] = new;
-        sem_wait(&(interhashmap->contents[partition_number]->sem));
-        arraylist_add(interhashmap->contents[partition_number], newpair);
-        interhashmap->size += 1;
+    PartitionLock(partition);
+    if (partition->open == NULL ||
+        !SegmentFits(partition->open, key_len, value_len)) {
+        partition->open =
+            SegmentInit(NULL, RecordSize(key_len, value_len), partition->node);
+        // pipeline mode sorts these at the end, the runs cover the others
+        if (ctx->pipeline) {
+            partition->open->next = partition->loose;
+            partition->loose = partition->open;
+        } else {
+            partition->open->next = partition->segments;
+            partition->segments = partition->open;
+        }
     }
+    SegmentPut(partition->open, hash, key, key_len, value, value_len);
+    partition->size += 1;
+    // SpillIfOverBudget reads bytes without the partition lock
+    __atomic_store_n(&partition->bytes,
+                     partition->bytes + RecordSize(key_len, value_len),
+                     __ATOMIC_RELAXED);
+    sem_post(&partition->sem);
 
-    sem_post(&(interhashmap->contents[partition_number]->sem));
+    if (ctx->options.memory_budget != 0) {
+        __atomic_add_fetch(&ctx->inmemory, RecordSize(key_len, value_len),
+                           __ATOMIC_RELAXED);
+        SpillIfOverBudget();
+    }
 }
 
-void debug_print_interhashmap(InterHashMap* interhashmap) {
-    printf("********************************************\n");
-    printf("InterHashMap:\n");
-    printf("Address:\t\tIndex:\t\tArrayList\n");
-    for (int i = 0; i < interhashmap->capacity; i++) {
-        printf("%p\t\t%d", &(interhashmap->contents[i]), i);
-        if (interhashmap->contents[i] == 0) {
-            printf("\t\t0\n");
-        } else {
-            // print ArrayList
-            printf("\t\t[");
-            for (int j = 0; j < interhashmap->contents[i]->capacity; j++) {
-                // if NULL
-                if (interhashmap->contents[i]->pairs[j] == 0) {
-                    printf("0 ");
-                } else {
-                    printf("(");
-                    printf("%s", interhashmap->contents[i]->pairs[j]->key);
-                    printf(", ");
-                    printf("%s",
-                           (char*)(interhashmap->contents[i]->pairs[j]->value));
-                    printf(") ");
-                }
-            }
-            printf("]\n");
-        }
+/**
+ * @brief Links a chain of filled segments into a partition under a single
+ * lock. In pipeline mode the chain is sorted into a run first. The memory
+ * budget is checked by EmitBuffersAdd, once the private buffers add up.
+ *
+ * @param interhashmap Pointer to interhashmap
+ * @param partition_number int partition receiving the segments
+ * @param chain Pointer to the first Segment of the chain
+ */
+void InterMapPutSegments(InterHashMap* interhashmap, int partition_number,
+                         Segment* chain) {
+    Partition* partition = interhashmap->contents[partition_number];
+    Segment* tail = chain;
+    size_t size = chain->count, bytes = chain->used;
+    Run* run = NULL;
+
+    while (tail->next != NULL) {
+        tail = tail->next;
+        size += tail->count;
+        bytes += tail->used;
+    }
+    // sorted by the mapper while the partition stays unlocked
+    if (ctx->pipeline) {
+        run = RunInit(chain, size);
     }
-    printf("********************************************\n");
-}
 
-unsigned long MR_DefaultHashPartition(char* key, int num_partitions) {
-    unsigned long hash = 5381;
-    int c;
-    while ((c = *key++) != '\0') hash = hash * 33 + c;
-    return hash % num_partitions;
-}
+    PartitionLock(partition);
+    tail->next = partition->segments;
+    partition->segments = chain;
+    partition->size += size;
+    __atomic_store_n(&partition->bytes, partition->bytes + bytes,
+                     __ATOMIC_RELAXED);
+    sem_post(&partition->sem);
 
-char* get_func(char* key, int partition_number) {
-    // printf("get_func key(%s, %d)\n", key, partition_number);
-    // printf("getting %s from partition number %d\n", key, partition_number);
-
-    // check if frequency > 0
-    // printf("Searching for %s\n", key);
-    // char* f = MapGet(freq, key);
-    // printf("f = %s\n", f);
-    // int newval;
-    // char newval_c;
-    // char temp = '1';
-    // char* temp_p = &temp;
-
-    /*
-    if (*(f) > '0') {
-        newval = atoi(f) - 1;
-        newval_c = newval + '0';
-        MapPut(freq, key, &newval_c, sizeof(char));
-        return temp_p;
+    if (run != NULL) {
+        PartitionAddRun(partition, run);
     }
-    return NULL;
-    */
-    // printf("HJERE\n");
-    void* f = MapGet(freq, key);
-    int newval;
-    char temp = '1';
-    char* temp_p = &temp;
-
-    if (*(int*)f > 0) {
-        newval = *(int*)f - 1; 
-        MapPut(freq, key, &newval, sizeof(int));
-        return temp_p;
+    if (ctx->options.memory_budget != 0) {
+        __atomic_add_fetch(&ctx->inmemory, bytes, __ATOMIC_RELAXED);
     }
-    return NULL;
+}
 
-    /*
-    ArrayList* partition = interhashmap->contents[partition_number];
-    MapPair* el;
-    int flag = 0;
-    if (partition != 0) {
-        // iterate to find key in partition
-        for (int i = 0; i < partition->size; i++) {
-            el = partition->pairs[i];
-            if (!strcmp(el->key, key) && el->marked == 0) {
-                flag = 1;
-                // mark element
-                el->marked = 1;
-                return el->value;
-            }
-            if (flag) {
-                break;
-            }
+void spill_write(int fd, char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            printf("Spill error! %s\n", strerror(errno));
+            exit(1);
         }
+        buf += n;
+        len -= n;
     }
-    return NULL;
-    */
 }
 
-int cmp(const void* a, const void* b) {
-    char* str1 = (*(MapPair**)a)->key;
-    char* str2 = (*(MapPair**)b)->key;
-    return strcmp(str1, str2);
-}
+/**
+ * @brief Opens an anonymous temp file for a partition's spilled runs. It is
+ * unlinked right away, so it disappears with the job or the process.
+ *
+ * @return int file descriptor
+ */
+int SpillFileOpen(void) {
+    char* dir = ctx->options.spill_dir;
+    char path[4096];
+    int fd;
 
-void* map_threads(void* args) {
-    for (;;) {
-        char* file;
-        pthread_mutex_lock(&mlock);
-        if (mapthreadargs->curr >= mapthreadargs->numfiles) {
-            pthread_mutex_unlock(&mlock);
-            return NULL;
-        }
-        file = mapthreadargs->files[mapthreadargs->curr];
-        mapthreadargs->curr += 1;
-        pthread_mutex_unlock(&mlock);
-        // printf("Map(%s)\n", file);
-        (*mapthreadargs->map)(file);
+    if (dir == NULL) dir = getenv("TMPDIR");
+    if (dir == NULL) dir = "/tmp";
+    snprintf(path, sizeof(path), "%s/mapreduce-spill-XXXXXX", dir);
+    fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Cannot create spill file in %s! %s\n", dir, strerror(errno));
+        exit(1);
     }
+    unlink(path);
+    return fd;
 }
 
-void* reduce_threads(void* args) {
-    ReduceThreadArgs* arguments = (ReduceThreadArgs*)args;
-    // printf("SORTING PARTITION %d\n", arguments->partition_number);
-    ArrayList* curr_partition =
-        interhashmap->contents[arguments->partition_number];
+/**
+ * @brief Sorts the records a partition holds in memory and writes them to its
+ * spill file as one run. The emptied segments go back for reuse.
+ *
+ * @param partition Pointer to Partition
+ */
+void PartitionSpill(Partition* partition) {
+    Segment* chain;
+    size_t size, bytes, n = 0, used = 0;
 
-    // printf("uhh2\n");
+    PartitionLock(partition);
+    chain = partition->segments;
+    size = partition->size;
+    bytes = partition->bytes;
+    partition->segments = NULL;
+    partition->open = NULL;
+    partition->size = 0;
+    __atomic_store_n(&partition->bytes, 0, __ATOMIC_RELAXED);
+    sem_post(&partition->sem);
+    if (size == 0) return;
 
-    // sorting phase
-    // printf("%ld\n", sizeof(curr_partition->pairs));
-    // printf("%ld\n", curr_partition->size);
-    // qsort(curr_partition->pairs, curr_partition->size, sizeof(MapPair*), cmp);
+    IndexEntry* index = (IndexEntry*)malloc(sizeof(IndexEntry) * size);
+    char* buf = (char*)malloc(SPILL_WRITE_SIZE);
+    if (index == NULL || buf == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    for (Segment* seg = chain; seg != NULL; seg = seg->next) {
+        n += SegmentIndex(seg, index + n);
+    }
+    qsort(index, n, sizeof(IndexEntry), cmp);
 
-    // printf("uhh3\n");
+    // only spillers touch the file, and they hold spilllock
+    if (partition->num_spills == 0) {
+        partition->spill_fd = SpillFileOpen();
+    }
+    partition->spills = (SpillRun*)realloc(
+        partition->spills, sizeof(SpillRun) * (partition->num_spills + 1));
+    SpillRun* run = &partition->spills[partition->num_spills++];
+    run->offset = lseek(partition->spill_fd, 0, SEEK_END);
 
-    // reducing phase
-    char* curr_key = curr_partition->pairs[0]->key;
-    // printf("RUNNING REDUCE THREAD FOR PARTITION %d, KEY = %s\n",
-    // arguments->partition_number, curr_key);
-    (*arguments->reduce)(curr_key, get_func, arguments->partition_number);
-
-    for (int j = 1; j < curr_partition->size; j++) {
-        // if new key encountered in same partition
-        if (strcmp(curr_partition->pairs[j]->key, curr_key)) {
-            curr_key = curr_partition->pairs[j]->key;
-            // printf("RUNNING REDUCE THREAD FOR PARTITION %d, KEY = %s\n",
-            // arguments->partition_number, curr_key);
-            (*arguments->reduce)(curr_key, get_func,
-                                 arguments->partition_number);
-        }
-    }
-    // printf("FINISHED REDUCE THREADS FOR PARTITION %d\n",
-    // arguments->partition_number);
-    free(arguments);
-    return NULL;
-}
+    // records keep their in-memory layout, padding included
+    for (size_t i = 0; i < n; i++) {
+        Record* record = index[i].record;
+        size_t rs = RecordSize(record->key_len, record->value_len);
+        if (used + rs > SPILL_WRITE_SIZE) {
+            spill_write(partition->spill_fd, buf, used);
+            used = 0;
+        }
+        if (rs > SPILL_WRITE_SIZE) {
+            spill_write(partition->spill_fd, (char*)record, rs);
+        } else {
+            memcpy(buf + used, record, rs);
+            used += rs;
+        }
+    }
+    spill_write(partition->spill_fd, buf, used);
+    run->end = lseek(partition->spill_fd, 0, SEEK_END);
+    partition->spilled += n;
+    if (ctx->collectstats) {
+        ctx->stats.spilled_records += n;
+        ctx->stats.spilled_bytes += run->end - run->offset;
+    }
+    free(buf);
+    free(index);
 
-void populate_freq(HashMap* freq, InterHashMap* interhashmap) {
-    // loop through every partition
-    for (int i = 0; i < interhashmap->capacity; i++) {
-        ArrayList* curr_part = interhashmap->contents[i];
-        // if partition is not empty
-        if (curr_part != 0) {
-            char* curr_key;
-            int count = 1;
-            // char count_c;
-            for(int j = 0; j < curr_part->size - 1; j++) {
-                curr_key = curr_part->pairs[j]->key;
-
-                // if next one is different
-                if (strcmp(curr_key, curr_part->pairs[j+1]->key)) {
-                    // count_c = count + '0';
-                    // printf("putting: %c\n", count_c);
-                    MapPut(freq, curr_key, &count, sizeof(int));
-                    curr_key = curr_part->pairs[j+1]->key;
-                    count = 1;
-                } else {
-                    count++;
-                }
-            }
-            // count_c = count + '0';
-            // printf("putting: %c\n", count_c);
-            MapPut(freq, curr_key, &count, sizeof(int));
+    pthread_mutex_lock(&ctx->segmentlock);
+    while (chain != NULL) {
+        Segment* next = chain->next;
+        // oversized segments are left to the arena
+        if (chain->capacity == SEGMENT_SIZE) {
+            chain->next = ctx->freesegments[partition->node];
+            __atomic_store_n(&ctx->freesegments[partition->node], chain,
+                             __ATOMIC_RELAXED);
         }
+        chain = next;
     }
+    pthread_mutex_unlock(&ctx->segmentlock);
+    __atomic_sub_fetch(&ctx->inmemory, bytes, __ATOMIC_RELAXED);
 }
 
-// threadify this
-void MR_Emit(char* key, char* value) {
-    // get partition number
-    // int partition_number =
-    // MR_DefaultHashPartition(key,interhashmap->capacity);
-
-    // acquire lock
-    // sem_wait(&(interhashmap->contents[partition_number]->sem));
-    InterMapPut(interhashmap, key, value);
-    // sem_post(&(interhashmap->contents[partition_number]->sem));
-    return;
+// bytes counted against options.memory_budget
+size_t MemoryInUse(void) {
+    return __atomic_load_n(&ctx->inmemory, __ATOMIC_RELAXED) +
+           __atomic_load_n(&ctx->buffered, __ATOMIC_RELAXED);
 }
 
-void MR_Run(int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce,
-            int num_reducers, Partitioner partition) {
-    // intialize interhashmap
-    interhashmap = InterMapInit(num_reducers);
-
-    //initialize freq
-    freq = MapInit();
+/**
+ * @brief Spills the largest partitions until half of options.memory_budget
+ * is free again, or until they are empty when the mappers' private buffers
+ * take more than that. A thread that finds someone else spilling moves on
+ * while it is only a little over, and waits for the spill otherwise, so
+ * mappers cannot run ahead of the disk.
+ */
+void SpillIfOverBudget(void) {
+    size_t budget = ctx->options.memory_budget;
+    size_t used = MemoryInUse();
 
-    // start threads for mapping phase
-    if (num_mappers > argc - 1) {
-        num_mappers = argc - 1;
+    if (used <= budget) return;
+    if (used <= budget + budget / SPILL_MARGIN) {
+        if (pthread_mutex_trylock(&ctx->spilllock) != 0) return;
+    } else {
+        pthread_mutex_lock(&ctx->spilllock);
     }
-    mapthreadargs = MapThreadArgsInit(map, argv + 1, argc - 1);
-    pthread_mutex_init(&mlock, NULL);
-    pthread_t mthread[num_mappers];
-    for (int i = 0; i < num_mappers; i++) {
-        if (pthread_create(&mthread[i], NULL, &map_threads, NULL) != 0) {
-            printf("something went wrong THERE\n");
+    while (MemoryInUse() > budget / 2) {
+        Partition* largest = NULL;
+        size_t largest_bytes = 0;
+        // mappers keep adding while this looks, an estimate is enough
+        for (int i = 0; i < ctx->interhashmap->capacity; i++) {
+            Partition* partition = ctx->interhashmap->contents[i];
+            size_t bytes =
+                __atomic_load_n(&partition->bytes, __ATOMIC_RELAXED);
+            if (largest == NULL || bytes > largest_bytes) {
+                largest = partition;
+                largest_bytes = bytes;
+            }
         }
+        if (largest_bytes == 0) break;
+        PartitionSpill(largest);
     }
+    pthread_mutex_unlock(&ctx->spilllock);
+}
 
-    // wait for threads to finish
-    for (int i = 0; i < num_mappers; i++) {
-        // printf("waiting for mthread[%d]\n", i);
-        if (pthread_join(mthread[i], NULL) != 0) {
-            printf("something went wrong HERE\n");
-        }
+/**
+ * @brief Appends a combiner output record, chaining a new segment in front
+ * when the current one is full
+ *
+ * @param cs Pointer to CombineState
+ * @param hash unsigned long hash of key
+ * @param key Char pointer to key
+ * @param key_len size_t key length
+ * @param value Char pointer to value
+ * @param value_len size_t value length
+ */
+void CombineStatePut(CombineState* cs, unsigned long hash, char* key,
+                     size_t key_len, char* value, size_t value_len) {
+    if (!SegmentFits(cs->output, key_len, value_len)) {
+        Segment* seg =
+            SegmentInit(cs->eb, RecordSize(key_len, value_len), cs->node);
+        seg->next = cs->output;
+        cs->output = seg;
     }
+    SegmentPut(cs->output, hash, key, key_len, value, value_len);
+}
 
-    pthread_mutex_destroy(&mlock);
+/**
+ * @brief Runs the combiner over a full private segment
+ *
+ * @param eb Pointer to the mapper's EmitBuffers
+ * @param input Pointer to the Segment being combined, recycled on return
+ * @param partition_number int partition the segment belongs to
+ * @param node int NUMA node of the input and the output, -1 for the caller's
+ * @return Segment* chain of segments holding what the combiner emitted
+ */
+Segment* EmitBufferCombine(EmitBuffers* eb, Segment* input,
+                           int partition_number, int node) {
+    CombineState cs;
+    size_t size;
 
-    // sort each partition
-    for (int i = 0; i < interhashmap->capacity; i++) {
-        // checks if partition is not empty
-        if (interhashmap->contents[i] != 0) {
-            qsort(interhashmap->contents[i]->pairs,
-                  interhashmap->contents[i]->size, sizeof(MapPair*), cmp);
+    IndexEntry* index;
+
+    if (eb->scratch_capacity < input->count) {
+        eb->scratch_capacity = input->count;
+        eb->scratch = (IndexEntry*)realloc(
+            eb->scratch, sizeof(IndexEntry) * eb->scratch_capacity);
+        if (ctx->options.grouping == MR_GROUP_HASH) {
+            eb->grouped = (IndexEntry*)realloc(
+                eb->grouped, sizeof(IndexEntry) * eb->scratch_capacity);
         }
     }
+    size = SegmentIndex(input, eb->scratch);
+    if (ctx->options.grouping == MR_GROUP_HASH) {
+        GroupIndex(eb->scratch, eb->grouped, size);
+        index = eb->grouped;
+    } else {
+        qsort(eb->scratch, size, sizeof(IndexEntry), cmp);
+        index = eb->scratch;
+    }
 
-    // debug_print_interhashmap(interhashmap);
+    cs.output = SegmentInit(eb, 0, node);
+    cs.eb = eb;
+    cs.node = node;
 
-    populate_freq(freq, interhashmap);
-    // printf("FREQ\n");
-    // debug_print_hashmap(freq);
+    // MR_Emit now lands in the output segments instead of the buffer
+    combinestate = &cs;
+    ReduceIndex(index, size, ctx->options.combine, partition_number);
+    combinestate = NULL;
 
-    // start threads for reducing phase (which also sorts)
-    // 1 thread per partition where partition is interhashmap->size
-    // printf("Size: %ld\n", interhashmap->size);
-    // printf("Capacity: %ld\n", interhashmap->capacity);
-    pthread_t rthread[interhashmap->size];
-    int j = 0;
-    for (int i = 0; i < interhashmap->capacity; i++) {
-        // printf("HERE\n");
-        ArrayList* partition = interhashmap->contents[i];
-        // if partition is occupied
-        if (partition != 0) {
-            // printf("here at %d\n", i);
-            reducethreadargs = ReduceThreadArgsInit(reduce, i);
-            if (pthread_create(&rthread[j], NULL, &reduce_threads,
-                               (void*)reducethreadargs) != 0) {
-                printf("something went wrongSSSSS\n");
-            }
-            j++;
+    SegmentRecycle(eb, input, node);
+    return cs.output;
+}
+
+/**
+ * @brief Makes room in a full private segment, either by combining it or by
+ * handing it over
+ *
+ * @param eb Pointer to the mapper's EmitBuffers
+ * @param seg Pointer to the full Segment
+ * @param partition_number int partition the segment belongs to
+ * @param full Pointer to the list receiving segments that are handed over
+ * @return Segment* segment to keep appending to, NULL if none
+ */
+Segment* EmitBuffersMakeRoom(EmitBuffers* eb, Segment* seg,
+                             int partition_number, Segment** full) {
+    if (ctx->options.combine != NULL) {
+        // staged records have no partition yet and stay with the mapper
+        int node = full != NULL
+                       ? -1
+                       : ctx->interhashmap->contents[partition_number]->node;
+        seg = EmitBufferCombine(eb, seg, partition_number, node);
+        // keep collapsing locally while the combiner is paying off
+        if (seg->next == NULL && seg->used < seg->capacity / 2) {
+            return seg;
         }
     }
+    if (full != NULL) {
+        Segment* tail = seg;
+        while (tail->next != NULL) tail = tail->next;
+        tail->next = *full;
+        *full = seg;
+    } else {
+        InterMapPutSegments(ctx->interhashmap, partition_number, seg);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Appends a record to the calling mapper's private partition buffer,
+ * handing the buffer to the shared partition once it fills up
+ *
+ * @param eb Pointer to the mapper's EmitBuffers
+ * @param partition_number int partition the record belongs to
+ * @param hash unsigned long hash of key
+ * @param key Char pointer to key
+ * @param key_len size_t key length
+ * @param value Char pointer to value
+ * @param value_len size_t value length
+ */
+void EmitBuffersAdd(EmitBuffers* eb, int partition_number, unsigned long hash,
+                    char* key, size_t key_len, char* value, size_t value_len) {
+    Segment* old = eb->buffers[partition_number];
+    Segment* seg = old;
 
-    // printf("Done creating\n");
+    if (seg != NULL && !SegmentFits(seg, key_len, value_len)) {
+        seg = EmitBuffersMakeRoom(eb, seg, partition_number, NULL);
+        if (seg != NULL && !SegmentFits(seg, key_len, value_len)) {
+            InterMapPutSegments(ctx->interhashmap, partition_number, seg);
+            seg = NULL;
+        }
+    }
+    if (seg == NULL) {
+        seg = SegmentInit(eb, RecordSize(key_len, value_len),
+                          ctx->interhashmap->contents[partition_number]->node);
+    }
+    eb->buffers[partition_number] = seg;
+    SegmentPut(seg, hash, key, key_len, value, value_len);
 
-    // wait for threads to finish
-    for (int i = 0; i < interhashmap->size; i++) {
-        // printf("waiting for rthread[%d]\n", i);
-        int rc = pthread_join(rthread[i], NULL);
-        if (rc != 0) {
-            printf("something went wrong at %d\n", i);
-            printf("code %d\n", rc);
+    if (ctx->options.memory_budget != 0 && seg != old) {
+        // open private segments count against the budget too
+        __atomic_add_fetch(&ctx->buffered, seg->capacity, __ATOMIC_RELAXED);
+        if (old != NULL) {
+            __atomic_sub_fetch(&ctx->buffered, old->capacity,
+                               __ATOMIC_RELAXED);
         }
+        SpillIfOverBudget();
     }
+}
 
-    // debug_print_interhashmap(interhashmap);
-}
\ No newline at end of file
+/**
+ * @brief Holds a record until the range split points are known, keeping a
+ * reservoir sample of the keys seen so far
+ *
+ * @param eb Pointer to the mapper's EmitBuffers
+ * @param hash unsigned long hash of key
+ * @param key Char pointer to key
+ * @param key_len size_t key length
+ * @param value Char pointer to value
+ * @param value_len size_t value length
+ */
+void EmitBuffersStage(EmitBuffers* eb, unsigned long hash, char* key,
+                      size_t key_len, char* value, size_t value_len) {
+    Segment* seg = eb->staged_open;
+    size_t slot = eb->num_samples;
+
+    if (seg != NULL && !SegmentFits(seg, key_len, value_len)) {
+        seg = EmitBuffersMakeRoom(eb, seg, 0, &eb->staged);
+        if (seg != NULL && !SegmentFits(seg, key_len, value_len)) {
+            seg->next = eb->staged;
+            eb->staged = seg;
+            seg = NULL;
+        }
+    }
+    if (seg == NULL) {
+        seg = SegmentInit(eb, RecordSize(key_len, value_len), -1);
+    }
+    eb->staged_open = seg;
+    SegmentPut(seg, hash, key, key_len, value, value_len);
+
+    eb->seen += 1;
+    if (eb->num_samples == SAMPLE_SIZE) {
+        // xorshift, replaces a sample with probability SAMPLE_SIZE / seen
+        eb->seed ^= eb->seed << 13;
+        eb->seed ^= eb->seed >> 7;
+        eb->seed ^= eb->seed << 17;
+        slot = eb->seed % eb->seen;
+        if (slot >= SAMPLE_SIZE) slot = SAMPLE_SIZE;
+        else free(eb->samples[slot].key);
+    } else {
+        eb->num_samples += 1;
+    }
+    if (slot < SAMPLE_SIZE) {
+        eb->samples[slot].key = strndup(key, key_len);
+        eb->samples[slot].bytes = key_len + value_len;
+    }
+}
+
+/**
+ * @brief Buffers a key value pair in the calling mapper's private buffers
+ *
+ * @param eb Pointer to the mapper's EmitBuffers
+ * @param hash unsigned long hash of key
+ * @param key Char pointer to key
+ * @param key_len size_t key length
+ * @param value Char pointer to value
+ * @param value_len size_t value length
+ */
+void EmitBuffersPut(EmitBuffers* eb, unsigned long hash, char* key,
+                    size_t key_len, char* value, size_t value_len) {
+    if (eb->staging) {
+        EmitBuffersStage(eb, hash, key, key_len, value, value_len);
+    } else {
+        EmitBuffersAdd(eb, PartitionOf(hash, key, eb->num_partitions), hash,
+                       key, key_len, value, value_len);
+    }
+}
+
+/**
+ * @brief Adds a mapper's samples to the shared pool, each weighted by the
+ * number of pairs it stands for. Called once the map tasks are done.
+ *
+ * @param eb Pointer to the mapper's EmitBuffers
+ */
+void EmitBuffersPublishSamples(EmitBuffers* eb) {
+    ctx->samples = realloc(
+        ctx->samples, sizeof(Sample) * (ctx->num_samples + eb->num_samples));
+    for (size_t i = 0; i < eb->num_samples; i++) {
+        eb->samples[i].weight = (double)eb->seen / eb->num_samples;
+        ctx->samples[ctx->num_samples++] = eb->samples[i];
+    }
+    eb->num_samples = 0;
+}
+
+/**
+ * @brief Moves the staged records into their range partitions
+ *
+ * @param eb Pointer to the mapper's EmitBuffers
+ */
+void EmitBuffersUnstage(EmitBuffers* eb) {
+    Segment* seg = eb->staged;
+
+    if (eb->staged_open != NULL) {
+        eb->staged_open->next = seg;
+        seg = eb->staged_open;
+    }
+    eb->staging = 0;
+    eb->staged = NULL;
+    eb->staged_open = NULL;
+
+    while (seg != NULL) {
+        Segment* next = seg->next;
+        char* p = seg->data;
+        while (p < seg->data + seg->used) {
+            Record* record = (Record*)p;
+            char* key = RecordKey(record);
+            EmitBuffersAdd(eb, MR_RangePartition(key, eb->num_partitions),
+                           record->hash, key, record->key_len,
+                           RecordValue(record), record->value_len);
+            p += RecordSize(record->key_len, record->value_len);
+        }
+        SegmentRecycle(eb, seg, -1);
+        seg = next;
+    }
+}
+
+int sample_cmp(const void* a, const void* b) {
+    return strcmp(((Sample*)a)->key, ((Sample*)b)->key);
+}
+
+/**
+ * @brief Picks split points from the pooled samples so that every range
+ * gets an equal share of both records and bytes
+ *
+ * @param num_partitions int number of ranges to cut
+ */
+void ComputeSplitPoints(int num_partitions) {
+    double total_records = 0, total_bytes = 0, cumulative = 0;
+    int k = 0;
+
+    // nothing was emitted, and MR_RangePartition without split points
+    // sends every key to the first range
+    if (ctx->num_samples == 0) return;
+
+    qsort(ctx->samples, ctx->num_samples, sizeof(Sample), sample_cmp);
+    for (size_t i = 0; i < ctx->num_samples; i++) {
+        total_records += ctx->samples[i].weight;
+        total_bytes += ctx->samples[i].weight * ctx->samples[i].bytes;
+    }
+
+    // NULL split points sort after every key
+    ctx->splitpoints = (char**)calloc(num_partitions, sizeof(char*));
+    for (size_t i = 0; i < ctx->num_samples && k < num_partitions - 1; i++) {
+        cumulative += 0.5 * ctx->samples[i].weight / total_records;
+        if (total_bytes > 0) {
+            cumulative += 0.5 * ctx->samples[i].weight *
+                          ctx->samples[i].bytes / total_bytes;
+        }
+        // a hot key may close several ranges, leaving the extra ones empty
+        while (k < num_partitions - 1 &&
+               cumulative >= (double)(k + 1) / num_partitions) {
+            ctx->splitpoints[k++] = ctx->samples[i].key;
+        }
+    }
+}
+
+/**
+ * @brief Hands every non-empty private buffer to its shared partition
+ *
+ * @param eb Pointer to the mapper's EmitBuffers
+ */
+void EmitBuffersFlush(EmitBuffers* eb) {
+    for (int i = 0; i < eb->num_partitions; i++) {
+        Segment* seg = eb->buffers[i];
+        if (seg != NULL && ctx->options.memory_budget != 0) {
+            __atomic_sub_fetch(&ctx->buffered, seg->capacity,
+                               __ATOMIC_RELAXED);
+        }
+        if (seg != NULL && seg->count != 0) {
+            if (ctx->options.combine != NULL) {
+                seg = EmitBufferCombine(eb, seg, i,
+                                        ctx->interhashmap->contents[i]->node);
+            }
+            InterMapPutSegments(ctx->interhashmap, i, seg);
+        }
+        eb->buffers[i] = NULL;
+    }
+}
+
+void debug_print_interhashmap(InterHashMap* interhashmap) {
+    printf("********************************************\n");
+    printf("InterHashMap:\n");
+    printf("Address:\t\tIndex:\t\tPartition\n");
+    for (int i = 0; i < interhashmap->capacity; i++) {
+        printf("%p\t\t%d", &(interhashmap->contents[i]), i);
+        if (interhashmap->contents[i]->size == 0) {
+            printf("\t\t0\n");
+        } else {
+            // print every segment of the partition
+            printf("\t\t[");
+            Segment* seg = interhashmap->contents[i]->segments;
+            for (; seg != NULL; seg = seg->next) {
+                char* p = seg->data;
+                while (p < seg->data + seg->used) {
+                    Record* record = (Record*)p;
+                    printf("(%s, %s) ", RecordKey(record),
+                           RecordValue(record));
+                    p += RecordSize(record->key_len, record->value_len);
+                }
+            }
+            printf("]\n");
+        }
+    }
+    printf("********************************************\n");
+}
+
+unsigned long MR_DefaultHashPartition(char* key, int num_partitions) {
+    return HashBytes(key, strlen(key)) % num_partitions;
+}
+
+/**
+ * @brief Picks the partition of a record, the default partitioner reuses
+ * the hash MR_Emit already computed
+ *
+ * @param hash unsigned long hash of key
+ * @param key Char pointer to key
+ * @param num_partitions int number of partitions
+ * @return int partition number
+ */
+int PartitionOf(unsigned long hash, char* key, int num_partitions) {
+    if (ctx->partitioner == MR_DefaultHashPartition) {
+        return hash % num_partitions;
+    }
+    return (*ctx->partitioner)(key, num_partitions);
+}
+
+unsigned long MR_RangePartition(char* key, int num_partitions) {
+    unsigned long lo = 0, hi = num_partitions - 1;
+
+    // until the split points are chosen everything goes to the first range
+    if (ctx->splitpoints == NULL) return 0;
+
+    // first range whose split point is not smaller than key
+    while (lo < hi) {
+        unsigned long mid = (lo + hi) / 2;
+        if (ctx->splitpoints[mid] == NULL ||
+            strcmp(key, ctx->splitpoints[mid]) <= 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+char* MergeNext(MergeState* m);
+
+char* get_func(char* key, int partition_number) {
+    // the current key's values sit between pos and end of the sorted run
+    Cursor* c = cursor;
+
+    if (c->merge != NULL) {
+        char* value = MergeNext(c->merge);
+        if (value != NULL) {
+            c->value_len = c->merge->taken->head.record->value_len;
+        }
+        return value;
+    }
+    if (c->pos < c->end) {
+        Record* record = c->index[c->pos++].record;
+        c->value_len = record->value_len;
+        return RecordValue(record);
+    }
+    return NULL;
+}
+
+int cmp(const void* a, const void* b) {
+    IndexEntry* e1 = (IndexEntry*)a;
+    IndexEntry* e2 = (IndexEntry*)b;
+    // most keys differ within their first bytes
+    if (e1->prefix != e2->prefix) return e1->prefix < e2->prefix ? -1 : 1;
+    // keys may hold NUL bytes, a key sorts before the longer ones it starts
+    size_t l1 = e1->record->key_len, l2 = e2->record->key_len;
+    int c = memcmp(RecordKey(e1->record), RecordKey(e2->record),
+                   l1 < l2 ? l1 : l2);
+    if (c != 0) return c;
+    return l1 < l2 ? -1 : l1 > l2;
+}
+
+/**
+ * @brief Checks whether two index entries carry the same key
+ *
+ * @return int nonzero when the keys are equal
+ */
+int same_key(IndexEntry* e1, IndexEntry* e2) {
+    return e1->prefix == e2->prefix && e1->record->hash == e2->record->hash &&
+           e1->record->key_len == e2->record->key_len &&
+           !memcmp(RecordKey(e1->record), RecordKey(e2->record),
+                   e1->record->key_len);
+}
+
+/**
+ * @brief Reorders an index so that the records of every key sit next to
+ * each other, in O(n) with a hash table instead of a sort
+ *
+ * @param index Pointer to the IndexEntry array to group
+ * @param out Pointer to an array of `size` entries receiving the result
+ * @param size size_t number of entries
+ */
+void GroupIndex(IndexEntry* index, IndexEntry* out, size_t size) {
+    size_t capacity = GROUP_TABLE_INIT_CAPACITY, num_groups = 0;
+    size_t* slots = (size_t*)calloc(capacity, sizeof(size_t));
+    Group* groups = (Group*)malloc(sizeof(Group) * (capacity / 2));
+    size_t* group_of = (size_t*)malloc(sizeof(size_t) * size);
+
+    for (size_t i = 0; i < size; i++) {
+        // every record carries the hash MR_Emit computed
+        unsigned long hash = index[i].record->hash;
+        size_t h = hash & (capacity - 1);
+
+        // slots hold group number + 1, 0 is empty
+        while (slots[h] != 0) {
+            Group* g = &groups[slots[h] - 1];
+            if (g->hash == hash && same_key(&index[g->first], &index[i])) {
+                break;
+            }
+            h = (h + 1) & (capacity - 1);
+        }
+        if (slots[h] == 0) {
+            groups[num_groups].hash = hash;
+            groups[num_groups].first = i;
+            groups[num_groups].count = 0;
+            slots[h] = ++num_groups;
+        }
+        group_of[i] = slots[h] - 1;
+        groups[group_of[i]].count += 1;
+
+        // keep the table at most half full
+        if (num_groups == capacity / 2) {
+            free(slots);
+            capacity *= 2;
+            slots = (size_t*)calloc(capacity, sizeof(size_t));
+            groups = (Group*)realloc(groups, sizeof(Group) * (capacity / 2));
+            for (size_t g = 0; g < num_groups; g++) {
+                h = groups[g].hash & (capacity - 1);
+                while (slots[h] != 0) h = (h + 1) & (capacity - 1);
+                slots[h] = g + 1;
+            }
+        }
+    }
+
+    // turn the counts into offsets, then scatter every record into place
+    size_t offset = 0;
+    for (size_t g = 0; g < num_groups; g++) {
+        size_t count = groups[g].count;
+        groups[g].count = offset;
+        offset += count;
+    }
+    for (size_t i = 0; i < size; i++) {
+        out[groups[group_of[i]].count++] = index[i];
+    }
+
+    free(slots);
+    free(groups);
+    free(group_of);
+}
+
+/**
+ * @brief Groups a partition's index by hash, the MR_GROUP_HASH stand-in for
+ * sorting it
+ *
+ * @param partition Pointer to Partition
+ */
+void PartitionGroup(Partition* partition) {
+    IndexEntry* grouped =
+        (IndexEntry*)malloc(sizeof(IndexEntry) * partition->size);
+    if (grouped == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    GroupIndex(partition->index, grouped, partition->size);
+    free(partition->index);
+    partition->index = grouped;
+}
+
+/**
+ * @brief Finds how many of the first `t` merged entries come from `a`
+ *
+ * @param t size_t position in the merged output
+ * @param a Pointer to the first sorted run
+ * @param m size_t length of a
+ * @param b Pointer to the second sorted run
+ * @param n size_t length of b
+ * @return size_t number of entries taken from a
+ */
+size_t corank(size_t t, IndexEntry* a, size_t m, IndexEntry* b, size_t n) {
+    size_t lo = t > n ? t - n : 0;
+    size_t hi = t < m ? t : m;
+
+    // smallest i where a[i] does not have to come before b[t - i - 1]
+    while (lo < hi) {
+        size_t i = (lo + hi) / 2;
+        if (cmp(&a[i], &b[t - i - 1]) < 0) {
+            lo = i + 1;
+        } else {
+            hi = i;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief Merges two sorted runs into `out`
+ *
+ * @param a Pointer to the first sorted run
+ * @param m size_t length of a
+ * @param b Pointer to the second sorted run
+ * @param n size_t length of b
+ * @param out Pointer to m + n entries receiving the merged run
+ */
+void MergeRuns(IndexEntry* a, size_t m, IndexEntry* b, size_t n,
+               IndexEntry* out) {
+    size_t i = 0, j = 0;
+
+    while (i < m && j < n) {
+        if (cmp(&b[j], &a[i]) < 0) {
+            *out++ = b[j++];
+        } else {
+            *out++ = a[i++];
+        }
+    }
+    memcpy(out, a + i, sizeof(IndexEntry) * (m - i));
+    out += m - i;
+    memcpy(out, b + j, sizeof(IndexEntry) * (n - j));
+}
+
+/**
+ * @brief Produces the slice [out_lo, out_hi) of merging two sorted runs, so
+ * a single merge can be split across threads
+ *
+ * @param task Pointer to a SORT_MERGE SortTask
+ */
+void merge_slice(SortTask* task) {
+    IndexEntry* a = task->src + task->lo;
+    IndexEntry* b = task->src + task->mid;
+    size_t m = task->mid - task->lo, n = task->hi - task->mid;
+    size_t t0 = task->out_lo - task->lo, t1 = task->out_hi - task->lo;
+    size_t i = corank(t0, a, m, b, n), j = t0 - i;
+    size_t i1 = corank(t1, a, m, b, n), j1 = t1 - i1;
+
+    MergeRuns(a + i, i1 - i, b + j, j1 - j, task->dst + task->out_lo);
+}
+
+void SortTaskRun(void* arg) {
+    SortTask* task = (SortTask*)arg;
+
+    switch (task->kind) {
+        case SORT_INDEX:
+            PartitionIndex(task->partition);
+            // the tail of a spilled partition is merged with sorted runs
+            if (ctx->options.grouping == MR_GROUP_HASH &&
+                task->partition->num_spills == 0) {
+                PartitionGroup(task->partition);
+            } else if (!task->split) {
+                // large partitions are cut into runs by the next round
+                qsort(task->partition->index, task->partition->size,
+                      sizeof(IndexEntry), cmp);
+            }
+            break;
+        case SORT_RUN:
+            qsort(task->src + task->lo, task->hi - task->lo,
+                  sizeof(IndexEntry), cmp);
+            break;
+        case SORT_MERGE:
+            merge_slice(task);
+            break;
+    }
+}
+
+/**
+ * @brief Runs the queued sort tasks on the worker pool and empties the queue
+ */
+void RunSortTasks(void) {
+    for (size_t i = 0; i < ctx->num_sorttasks; i++) {
+        SchedulerSubmitOn(ctx->scheduler, ctx->sorttasks[i].partition->node,
+                          SortTaskRun, &ctx->sorttasks[i]);
+    }
+    SchedulerWait(ctx->scheduler);
+    ctx->num_sorttasks = 0;
+}
+
+SortTask* sorttask_add(SortTaskKind kind, Partition* partition) {
+    SortTask* task = &ctx->sorttasks[ctx->num_sorttasks++];
+    memset(task, 0, sizeof(SortTask));
+    task->kind = kind;
+    task->partition = partition;
+    return task;
+}
+
+/**
+ * @brief Indexes and sorts every partition in parallel. A partition larger
+ * than its share of the workers is cut into runs that are sorted as separate
+ * tasks, then merged level by level with every merge split into tasks.
+ */
+void SortPartitions(void) {
+    int nthreads = ctx->scheduler->num_workers;
+    size_t total = 0, max_tasks = ctx->interhashmap->capacity;
+    SortState* state = (SortState*)calloc(ctx->interhashmap->capacity,
+                                          sizeof(SortState));
+    int levels = 0;
+
+    for (int i = 0; i < ctx->interhashmap->capacity; i++) {
+        total += ctx->interhashmap->contents[i]->size;
+    }
+
+    // decide which partitions need more than one core
+    for (int i = 0; i < ctx->interhashmap->capacity; i++) {
+        Partition* partition = ctx->interhashmap->contents[i];
+        int runs = 1;
+        if (ctx->options.grouping == MR_GROUP_SORT &&
+            partition->size >= 2 * PARALLEL_SORT_MIN &&
+            partition->size * nthreads > total) {
+            while (runs * 2 <= nthreads &&
+                   partition->size / (runs * 2) >= PARALLEL_SORT_MIN) {
+                runs *= 2;
+            }
+        }
+        state[i].runs = runs;
+        if (runs > 1) {
+            int l = 0;
+            while ((1 << l) < runs) l++;
+            if (l > levels) levels = l;
+            max_tasks += runs * nthreads;
+        }
+    }
+    ctx->sorttasks = (SortTask*)malloc(sizeof(SortTask) * max_tasks);
+
+    // build the indexes, sorting the small partitions right away
+    for (int i = 0; i < ctx->interhashmap->capacity; i++) {
+        if (ctx->interhashmap->contents[i]->size != 0) {
+            SortTask* task =
+                sorttask_add(SORT_INDEX, ctx->interhashmap->contents[i]);
+            task->split = state[i].runs > 1;
+        }
+    }
+    RunSortTasks();
+
+    // sort the runs of the large partitions
+    for (int i = 0; i < ctx->interhashmap->capacity; i++) {
+        Partition* partition = ctx->interhashmap->contents[i];
+        if (state[i].runs == 1) continue;
+        state[i].src = partition->index;
+        state[i].dst =
+            (IndexEntry*)malloc(sizeof(IndexEntry) * partition->size);
+        state[i].bounds = (size_t*)malloc(sizeof(size_t) * (state[i].runs + 1));
+        for (int r = 0; r <= state[i].runs; r++) {
+            state[i].bounds[r] = partition->size * r / state[i].runs;
+        }
+        for (int r = 0; r < state[i].runs; r++) {
+            SortTask* task = sorttask_add(SORT_RUN, partition);
+            task->src = state[i].src;
+            task->lo = state[i].bounds[r];
+            task->hi = state[i].bounds[r + 1];
+        }
+    }
+    RunSortTasks();
+
+    // merge pairs of runs until one is left
+    for (int l = 0; l < levels; l++) {
+        for (int i = 0; i < ctx->interhashmap->capacity; i++) {
+            SortState* st = &state[i];
+            if (st->runs == 1) continue;
+            // every merge of this level gets the same number of threads
+            int slices = nthreads / (st->runs / 2);
+            if (slices < 1) slices = 1;
+            for (int r = 0; r < st->runs; r += 2) {
+                size_t lo = st->bounds[r], hi = st->bounds[r + 2];
+                for (int k = 0; k < slices; k++) {
+                    SortTask* task = sorttask_add(
+                        SORT_MERGE, ctx->interhashmap->contents[i]);
+                    task->src = st->src;
+                    task->dst = st->dst;
+                    task->lo = lo;
+                    task->mid = st->bounds[r + 1];
+                    task->hi = hi;
+                    task->out_lo = lo + (hi - lo) * k / slices;
+                    task->out_hi = lo + (hi - lo) * (k + 1) / slices;
+                }
+                st->bounds[r / 2 + 1] = hi;
+            }
+        }
+        RunSortTasks();
+        for (int i = 0; i < ctx->interhashmap->capacity; i++) {
+            SortState* st = &state[i];
+            if (st->runs == 1) continue;
+            IndexEntry* tmp = st->src;
+            st->src = st->dst;
+            st->dst = tmp;
+            st->runs /= 2;
+            if (st->runs == 1) {
+                // the fully merged index may have ended up in the scratch
+                ctx->interhashmap->contents[i]->index = st->src;
+                free(st->dst);
+                free(st->bounds);
+            }
+        }
+    }
+
+    free(ctx->sorttasks);
+    ctx->sorttasks = NULL;
+    free(state);
+}
+
+/**
+ * @brief Indexes and sorts a chain of segments into a level 0 run
+ *
+ * @param chain Pointer to the first Segment of the chain
+ * @param size size_t number of records in the chain
+ * @return Run* Pointer to Run
+ */
+Run* RunInit(Segment* chain, size_t size) {
+    Run* run = (Run*)malloc(sizeof(Run));
+    size_t n = 0;
+
+    run->index = (IndexEntry*)malloc(sizeof(IndexEntry) * size);
+    if (run->index == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    for (Segment* seg = chain; seg != NULL; seg = seg->next) {
+        n += SegmentIndex(seg, run->index + n);
+    }
+    qsort(run->index, n, sizeof(IndexEntry), cmp);
+    run->next = NULL;
+    run->size = n;
+    run->level = 0;
+    return run;
+}
+
+/**
+ * @brief Hands a sorted run to its partition. When a run of the same level
+ * is already waiting the two are merged as a new task, so runs keep growing
+ * like the digits of a binary counter while the mappers are still going.
+ *
+ * @param partition Pointer to Partition
+ * @param run Pointer to Run
+ */
+void PartitionAddRun(Partition* partition, Run* run) {
+    Run* other = NULL;
+
+    PartitionLock(partition);
+    for (Run** r = &partition->runs; *r != NULL; r = &(*r)->next) {
+        if ((*r)->level == run->level) {
+            other = *r;
+            *r = other->next;
+            break;
+        }
+    }
+    if (other == NULL) {
+        run->next = partition->runs;
+        partition->runs = run;
+    }
+    sem_post(&partition->sem);
+
+    if (other != NULL) {
+        MergeTask* task = (MergeTask*)malloc(sizeof(MergeTask));
+        task->partition = partition;
+        task->a = other;
+        task->b = run;
+        SchedulerSubmitOn(ctx->scheduler, partition->node, merge_task, task);
+    }
+}
+
+void merge_task(void* arg) {
+    MergeTask* task = (MergeTask*)arg;
+    Run* a = task->a;
+    Run* b = task->b;
+    IndexEntry* out =
+        (IndexEntry*)malloc(sizeof(IndexEntry) * (a->size + b->size));
+
+    if (out == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    MergeRuns(a->index, a->size, b->index, b->size, out);
+    free(a->index);
+    free(b->index);
+    a->index = out;
+    a->size += b->size;
+    a->level += 1;
+    free(b);
+
+    // the merged run may find a partner of its own
+    PartitionAddRun(task->partition, a);
+    free(task);
+}
+
+int run_size_cmp(const void* a, const void* b) {
+    size_t s1 = (*(Run**)a)->size, s2 = (*(Run**)b)->size;
+    return s1 < s2 ? -1 : s1 > s2;
+}
+
+/**
+ * @brief Merges what is left of a partition's runs into its index once the
+ * map phase is over, smallest runs first. Runs of distinct levels remain, so
+ * this touches each record only a few times.
+ *
+ * @param arg Pointer to Partition
+ */
+void finish_task(void* arg) {
+    Partition* partition = (Partition*)arg;
+    size_t num_runs = 0;
+
+    // records that came in through InterMapPut get a run of their own
+    if (partition->loose != NULL) {
+        Segment* tail = partition->loose;
+        size_t size = tail->count;
+        while (tail->next != NULL) {
+            tail = tail->next;
+            size += tail->count;
+        }
+        Run* run = RunInit(partition->loose, size);
+        run->next = partition->runs;
+        partition->runs = run;
+        tail->next = partition->segments;
+        partition->segments = partition->loose;
+        partition->loose = NULL;
+    }
+
+    for (Run* r = partition->runs; r != NULL; r = r->next) num_runs++;
+    if (num_runs == 0) return;
+    Run** runs = (Run**)malloc(sizeof(Run*) * num_runs);
+    num_runs = 0;
+    for (Run* r = partition->runs; r != NULL; r = r->next) {
+        runs[num_runs++] = r;
+    }
+    qsort(runs, num_runs, sizeof(Run*), run_size_cmp);
+
+    Run* acc = runs[0];
+    for (size_t i = 1; i < num_runs; i++) {
+        IndexEntry* out = (IndexEntry*)malloc(sizeof(IndexEntry) *
+                                              (acc->size + runs[i]->size));
+        if (out == NULL) {
+            printf("Malloc error! %s\n", strerror(errno));
+            exit(1);
+        }
+        MergeRuns(acc->index, acc->size, runs[i]->index, runs[i]->size, out);
+        free(acc->index);
+        free(runs[i]->index);
+        acc->index = out;
+        acc->size += runs[i]->size;
+        free(runs[i]);
+    }
+    partition->index = acc->index;
+    partition->runs = NULL;
+    free(acc);
+    free(runs);
+}
+
+void map_task(void* arg) {
+    MapTask* task = (MapTask*)arg;
+
+    // whichever worker runs the task buffers (or counts) its output
+    if (ctx->workersketches != NULL) {
+        threadsketch = ctx->workersketches[SchedulerWorkerId()];
+    } else {
+        emitbuffers = ctx->workerbuffers[SchedulerWorkerId()];
+    }
+    // printf("Map(%s)\n", task->file);
+    if (ctx->mapthreadargs->map_range != NULL) {
+        (*ctx->mapthreadargs->map_range)(task->file, task->offset,
+                                         task->length);
+    } else {
+        (*ctx->mapthreadargs->map)(task->file);
+    }
+    emitbuffers = NULL;
+    threadsketch = NULL;
+
+    if (ctx->collectstats) {
+        __atomic_add_fetch(&ctx->stats.emitted_records, threadrecords,
+                           __ATOMIC_RELAXED);
+        __atomic_add_fetch(&ctx->stats.emitted_bytes, threadbytes,
+                           __ATOMIC_RELAXED);
+        threadrecords = 0;
+        threadbytes = 0;
+    }
+}
+
+/**
+ * @brief One of the num_mappers mapper threads of a job, when there are
+ * fewer of them than workers. It keeps taking the next map task until there
+ * are none left.
+ */
+void mapper_task(void* arg) {
+    int i;
+
+    while ((i = __atomic_fetch_add(&ctx->next_maptask, 1, __ATOMIC_RELAXED)) <
+           ctx->mapthreadargs->numtasks) {
+        map_task(&ctx->mapthreadargs->tasks[i]);
+    }
+}
+
+void flush_task(void* arg) {
+    EmitBuffers* eb = (EmitBuffers*)arg;
+
+    if (eb->staging) {
+        EmitBuffersUnstage(eb);
+    }
+    // hand whatever is left over to the shared partitions
+    EmitBuffersFlush(eb);
+    EmitBuffersFree(eb);
+}
+
+/**
+ * @brief Calls `reduce` once per key of a sorted index, with get_func
+ * streaming that key's values
+ *
+ * @param index Pointer to the sorted IndexEntry run
+ * @param size size_t number of entries
+ * @param reduce Reducer (or combiner) to call
+ * @param partition_number int partition passed along to `reduce`
+ */
+void ReduceIndex(IndexEntry* index, size_t size, Reducer reduce,
+                 int partition_number) {
+    Cursor c;
+    Cursor* saved = cursor;
+    size_t start = 0;
+
+    cursor = &c;
+    c.index = index;
+    c.merge = NULL;
+    while (start < size) {
+        size_t end = start + 1;
+        while (end < size && same_key(&index[start], &index[end])) end++;
+        c.pos = start;
+        c.end = end;
+        c.record = index[start].record;
+        (*reduce)(RecordKey(index[start].record), get_func,
+                  partition_number);
+        // values the reducer did not ask for are skipped
+        start = end;
+    }
+    cursor = saved;
+}
+
+/**
+ * @brief Moves a reader to the next record of its run, reading the spill
+ * file in SPILL_READ_SIZE blocks. The previous record is overwritten.
+ *
+ * @param r Pointer to RunReader
+ */
+void RunReaderNext(RunReader* r) {
+    if (r->fd < 0) {
+        r->head = r->i < r->n ? r->index[r->i++] : (IndexEntry){0, NULL};
+        return;
+    }
+
+    size_t avail = r->buf_len - r->buf_pos;
+    size_t need = sizeof(Record);
+    if (avail >= sizeof(Record)) {
+        Record* record = (Record*)(r->buf + r->buf_pos);
+        need = RecordSize(record->key_len, record->value_len);
+    }
+    if (avail < need) {
+        if (avail == 0 && r->pos == r->end) {
+            r->head.record = NULL;
+            return;
+        }
+        // move what is left to the front and top the buffer up
+        memmove(r->buf, r->buf + r->buf_pos, avail);
+        r->buf_len = avail;
+        r->buf_pos = 0;
+        for (;;) {
+            if (need > r->buf_size) {
+                r->buf_size = need;
+                r->buf = (char*)realloc(r->buf, r->buf_size);
+            }
+            size_t want = r->buf_size - r->buf_len;
+            if (want > (size_t)(r->end - r->pos)) want = r->end - r->pos;
+            ssize_t got = pread(r->fd, r->buf + r->buf_len, want, r->pos);
+            if (got <= 0) {
+                printf("Spill error! %s\n", strerror(errno));
+                exit(1);
+            }
+            r->buf_len += got;
+            r->pos += got;
+            if (r->buf_len >= sizeof(Record)) {
+                Record* record = (Record*)r->buf;
+                need = RecordSize(record->key_len, record->value_len);
+            }
+            if (r->buf_len >= need) break;
+        }
+    }
+
+    Record* record = (Record*)(r->buf + r->buf_pos);
+    r->head.prefix = KeyPrefix(RecordKey(record), record->key_len);
+    r->head.record = record;
+    r->buf_pos += RecordSize(record->key_len, record->value_len);
+}
+
+void merge_sift_down(MergeState* m, int i) {
+    for (;;) {
+        int smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < m->n && cmp(&m->heap[l]->head, &m->heap[smallest]->head) < 0)
+            smallest = l;
+        if (r < m->n && cmp(&m->heap[r]->head, &m->heap[smallest]->head) < 0)
+            smallest = r;
+        if (smallest == i) return;
+        RunReader* tmp = m->heap[i];
+        m->heap[i] = m->heap[smallest];
+        m->heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+/**
+ * @brief Steps past the record handed out last. It is only done now so the
+ * value stays readable until the reducer asks for the next one.
+ *
+ * @param m Pointer to MergeState
+ */
+void MergeAdvance(MergeState* m) {
+    RunReader* r = m->taken;
+
+    if (r == NULL) return;
+    m->taken = NULL;
+    RunReaderNext(r);
+    if (r->head.record == NULL) {
+        m->heap[0] = m->heap[--m->n];
+    }
+    merge_sift_down(m, 0);
+}
+
+/**
+ * @brief Next value of the current key out of the merge, NULL once the
+ * smallest remaining record has another key
+ *
+ * @param m Pointer to MergeState
+ * @return char* value, valid until the next call
+ */
+char* MergeNext(MergeState* m) {
+    MergeAdvance(m);
+    if (m->n == 0 || !same_key(&m->heap[0]->head, &m->current)) {
+        return NULL;
+    }
+    m->taken = m->heap[0];
+    return RecordValue(m->heap[0]->head.record);
+}
+
+/**
+ * @brief Reduces a partition that was spilled, streaming a k-way merge of its
+ * runs on disk and of its sorted in-memory tail through get_func
+ *
+ * @param partition Pointer to Partition
+ * @param reduce Reducer to call
+ * @param partition_number int partition passed along to `reduce`
+ */
+void ReduceMerge(Partition* partition, Reducer reduce, int partition_number) {
+    int k = partition->num_spills + 1;
+    RunReader* readers = (RunReader*)calloc(k, sizeof(RunReader));
+    MergeState m;
+    Cursor c;
+    Cursor* saved = cursor;
+
+    memset(&m, 0, sizeof(MergeState));
+    m.heap = (RunReader**)malloc(sizeof(RunReader*) * k);
+    for (int i = 0; i < k; i++) {
+        RunReader* r = &readers[i];
+        if (i < partition->num_spills) {
+            r->fd = partition->spill_fd;
+            r->pos = partition->spills[i].offset;
+            r->end = partition->spills[i].end;
+            r->buf_size = SPILL_READ_SIZE;
+            r->buf = (char*)malloc(r->buf_size);
+        } else {
+            r->fd = -1;
+            r->index = partition->index;
+            r->n = partition->size;
+        }
+        RunReaderNext(r);
+        if (r->head.record != NULL) m.heap[m.n++] = r;
+    }
+    for (int i = m.n / 2 - 1; i >= 0; i--) merge_sift_down(&m, i);
+
+    memset(&c, 0, sizeof(Cursor));
+    c.merge = &m;
+    cursor = &c;
+    while (m.n > 0) {
+        // the key is copied, the reader's buffer moves on under the reducer
+        Record* first = m.heap[0]->head.record;
+        size_t size = RecordSize(first->key_len, first->value_len);
+        if (size > m.current_size) {
+            m.current_size = size;
+            m.current.record = (Record*)realloc(m.current.record, size);
+        }
+        memcpy(m.current.record, first, size);
+        m.current.prefix = m.heap[0]->head.prefix;
+        c.record = m.current.record;
+
+        (*reduce)(RecordKey(c.record), get_func, partition_number);
+        // values the reducer did not ask for are skipped
+        while (MergeNext(&m) != NULL) continue;
+    }
+    cursor = saved;
+
+    for (int i = 0; i < k; i++) free(readers[i].buf);
+    free(readers);
+    free(m.heap);
+    free(m.current.record);
+}
+
+void reduce_task(void* arg) {
+    ReduceTask* task = (ReduceTask*)arg;
+    Partition* partition = ctx->interhashmap->contents[task->partition_number];
+
+    // reducing phase
+    if (partition->num_spills != 0) {
+        ReduceMerge(partition, task->reduce, task->partition_number);
+        return;
+    }
+    ReduceIndex(partition->index + task->lo, task->hi - task->lo,
+                task->reduce, task->partition_number);
+}
+
+/**
+ * @brief One of the num_reducers reducer threads of a job, it keeps taking
+ * the next reduce task until there are none left. The tasks of its own node
+ * go first, those of other nodes once they run out.
+ */
+void reducer_task(void* arg) {
+    int own = ThreadNode();
+    size_t i;
+
+    for (int n = 0; n < ctx->num_nodes; n++) {
+        int node = (own + n) % ctx->num_nodes;
+        while ((i = __atomic_fetch_add(&ctx->next_reducetask[node], 1,
+                                       __ATOMIC_RELAXED)) <
+               ctx->end_reducetask[node]) {
+            reduce_task(&ctx->reducetasks[i]);
+        }
+    }
+}
+
+int reduce_task_cmp(const void* a, const void* b) {
+    const ReduceTask* t1 = (ReduceTask*)a;
+    const ReduceTask* t2 = (ReduceTask*)b;
+    if (t1->node != t2->node) return t1->node - t2->node;
+    return t1->weight > t2->weight ? -1 : t1->weight < t2->weight;
+}
+
+/**
+ * @brief Cuts every partition into reduce tasks. Sorted partitions stay
+ * whole so their keys keep reaching the reducer in order, hash grouped ones
+ * are split at key boundaries so a skewed partition is shared by workers.
+ *
+ * @param reduce Reducer to run
+ * @param num_tasks Pointer receiving the number of tasks
+ * @return ReduceTask* array of tasks
+ */
+ReduceTask* ReduceTasksInit(Reducer reduce, size_t* num_tasks) {
+    size_t capacity = ctx->interhashmap->capacity, n = 0;
+    ReduceTask* tasks = (ReduceTask*)malloc(sizeof(ReduceTask) * capacity);
+
+    for (int i = 0; i < ctx->interhashmap->capacity; i++) {
+        Partition* partition = ctx->interhashmap->contents[i];
+        size_t lo = 0;
+        // spilled partitions are merged as a whole, even an empty tail
+        if (partition->num_spills != 0) {
+            if (n == capacity) {
+                capacity *= 2;
+                tasks = (ReduceTask*)realloc(tasks,
+                                             sizeof(ReduceTask) * capacity);
+            }
+            tasks[n].reduce = reduce;
+            tasks[n].partition_number = i;
+            tasks[n].lo = 0;
+            tasks[n].hi = partition->size;
+            tasks[n].weight = partition->size + partition->spilled;
+            tasks[n].node = partition->node;
+            n++;
+            continue;
+        }
+        while (lo < partition->size) {
+            size_t hi = partition->size;
+            if (ctx->options.grouping == MR_GROUP_HASH &&
+                hi - lo > 2 * REDUCE_TASK_SIZE) {
+                hi = lo + REDUCE_TASK_SIZE;
+                while (hi < partition->size &&
+                       same_key(&partition->index[hi - 1],
+                                &partition->index[hi])) {
+                    hi++;
+                }
+            }
+            if (n == capacity) {
+                capacity *= 2;
+                tasks = (ReduceTask*)realloc(tasks,
+                                             sizeof(ReduceTask) * capacity);
+            }
+            tasks[n].reduce = reduce;
+            tasks[n].partition_number = i;
+            tasks[n].lo = lo;
+            tasks[n].hi = hi;
+            tasks[n].weight = hi - lo;
+            tasks[n].node = partition->node;
+            n++;
+            lo = hi;
+        }
+    }
+    *num_tasks = n;
+    return tasks;
+}
+
+/**
+ * @brief Routes a record to where the calling thread stores its output
+ *
+ * @param key Char pointer to key
+ * @param key_len size_t key length
+ * @param value Char pointer to value
+ * @param value_len size_t value length
+ * @param weight unsigned long what the pair counts for in a sketch job
+ */
+void emit_record(char* key, size_t key_len, char* value, size_t value_len,
+                 unsigned long weight) {
+    unsigned long hash;
+
+    // the one place a key is hashed, combiners re-emitting theirs skip it
+    if (cursor != NULL && key == RecordKey(cursor->record)) {
+        hash = cursor->record->hash;
+    } else {
+        hash = HashBytes(key, key_len);
+    }
+
+    if (ctx->collectstats && (emitbuffers != NULL || threadsketch != NULL) &&
+        combinestate == NULL) {
+        threadrecords += 1;
+        threadbytes += key_len + value_len;
+    }
+
+    // map tasks buffer privately, anyone else goes straight through
+    if (threadsketch != NULL) {
+        if (weight != 0) {
+            SketchAdd(threadsketch, hash, key, key_len, weight);
+        }
+    } else if (combinestate != NULL) {
+        CombineStatePut(combinestate, hash, key, key_len, value, value_len);
+    } else if (emitbuffers != NULL) {
+        EmitBuffersPut(emitbuffers, hash, key, key_len, value, value_len);
+    } else {
+        InterMapPut(ctx->interhashmap, hash, key, key_len, value, value_len);
+    }
+}
+
+void MR_Emit(char* key, char* value) {
+    emit_record(key, strlen(key), value, strlen(value), 1);
+}
+
+void MR_EmitBytes(char* key, size_t key_len, char* value, size_t value_len) {
+    // a custom partitioner is handed the key as a C string
+    if (ctx->partitioner != MR_DefaultHashPartition &&
+        (cursor == NULL || key != RecordKey(cursor->record))) {
+        char* copy = strndup(key, key_len);
+        emit_record(copy, key_len, value, value_len, 1);
+        free(copy);
+        return;
+    }
+    emit_record(key, key_len, value, value_len, 1);
+}
+
+void MR_EmitInt(char* key, long value) {
+    char buf[sizeof(long)];
+    size_t len = 1;
+
+    // little-endian, without the bytes sign extension gives back
+    for (size_t i = 0; i < sizeof(long); i++) {
+        buf[i] = (char)((unsigned long)value >> (8 * i));
+    }
+    while (len < sizeof(long) && (value >> (8 * len - 1) != 0 &&
+                                  value >> (8 * len - 1) != -1)) {
+        len++;
+    }
+    emit_record(key, strlen(key), buf, len, value > 0 ? value : 0);
+}
+
+int MR_GetInt(Getter get_func, char* key, int partition_number, long* value) {
+    unsigned char* p = (unsigned char*)(*get_func)(key, partition_number);
+    size_t len;
+
+    if (p == NULL) return 0;
+    len = cursor->value_len;
+    *value = len != 0 && (p[len - 1] & 0x80) ? -1 : 0;
+    while (len-- > 0) {
+        *value = (long)(((unsigned long)*value << 8) | p[len]);
+    }
+    return 1;
+}
+
+size_t MR_ValueLength(void) { return cursor->value_len; }
+
+size_t MR_CurrentKeyLength(void) { return cursor->record->key_len; }
+
+unsigned long MR_CurrentKeyHash(void) { return cursor->record->hash; }
+
+void worker_start(void* arg) {
+    ctx = (MR_Context*)arg;
+    if (ctx->topology != NULL) {
+        TopologyPin(ctx->topology, SchedulerWorkerId());
+    }
+}
+
+MR_Context* MR_ContextCreate(int num_workers, MR_Options* options) {
+    MR_Context* context = (MR_Context*)calloc(1, sizeof(MR_Context));
+    if (context == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    pthread_mutex_init(&context->spilllock, NULL);
+    pthread_mutex_init(&context->segmentlock, NULL);
+    pthread_mutex_init(&context->arenalock, NULL);
+    if (num_workers < 1) num_workers = 1;
+
+    // threads that float between nodes have no node to keep memory on
+    context->num_nodes = 1;
+    if (options != NULL && options->pin_threads) {
+        context->topology = TopologyInit(num_workers);
+        context->num_nodes = context->topology->num_nodes;
+    }
+    context->freesegments =
+        (Segment**)calloc(context->num_nodes, sizeof(Segment*));
+    context->next_reducetask =
+        (size_t*)calloc(context->num_nodes, sizeof(size_t));
+    context->end_reducetask =
+        (size_t*)calloc(context->num_nodes, sizeof(size_t));
+    context->workerarenas =
+        (Arena**)malloc(sizeof(Arena*) * num_workers * context->num_nodes);
+    for (int i = 0; i < num_workers * context->num_nodes; i++) {
+        context->workerarenas[i] = ArenaInit(0);
+        if (context->num_nodes > 1) {
+            context->workerarenas[i]->node = i % context->num_nodes;
+        }
+    }
+
+    // every worker works for this context only
+    context->scheduler = SchedulerInit(
+        num_workers,
+        context->topology != NULL ? context->topology->nodes : NULL,
+        worker_start, context);
+    return context;
+}
+
+void MR_ContextDestroy(MR_Context* context) {
+    int num_workers = context->scheduler->num_workers;
+
+    SchedulerFree(context->scheduler);
+    for (int i = 0; i < num_workers * context->num_nodes; i++) {
+        ArenaFree(context->workerarenas[i]);
+    }
+    if (context->interhashmap != NULL) {
+        InterMapFree(context->interhashmap);
+    }
+    StatsFree(&context->stats);
+    pthread_mutex_destroy(&context->spilllock);
+    pthread_mutex_destroy(&context->segmentlock);
+    pthread_mutex_destroy(&context->arenalock);
+    if (context->topology != NULL) {
+        TopologyFree(context->topology);
+    }
+    free(context->freesegments);
+    free(context->next_reducetask);
+    free(context->end_reducetask);
+    free(context->workerarenas);
+    free(context);
+}
+
+void MR_Run(int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce,
+            int num_reducers, Partitioner partition) {
+    MR_RunWithOptions(argc, argv, map, num_mappers, reduce, num_reducers,
+                      partition, NULL);
+}
+
+void MR_RunWithOptions(int argc, char* argv[], Mapper map, int num_mappers,
+                       Reducer reduce, int num_reducers, Partitioner partition,
+                       MR_Options* opts) {
+    // a context just for this job
+    MR_Context* context = MR_ContextCreate(
+        num_mappers > num_reducers ? num_mappers : num_reducers, opts);
+    ContextRun(context, argc, argv, map, num_mappers, reduce, num_reducers,
+               partition, opts);
+    MR_ContextDestroy(context);
+}
+
+/**
+ * @brief Sets the calling thread's context up for a new job
+ *
+ * @param opts Pointer to MR_Options, NULL for the defaults
+ * @param partition Partitioner, NULL for MR_DefaultHashPartition
+ */
+void JobStart(MR_Options* opts, Partitioner partition) {
+    // NULL means every option keeps its default
+    memset(&ctx->options, 0, sizeof(MR_Options));
+    if (opts != NULL) {
+        ctx->options = *opts;
+    }
+    ctx->partitioner = partition != NULL ? partition : MR_DefaultHashPartition;
+    // hash grouping never sorts, so there is nothing to pipeline, and
+    // spilling would pull the records out from under the runs
+    ctx->pipeline = ctx->options.pipeline &&
+                    ctx->options.grouping == MR_GROUP_SORT &&
+                    ctx->options.memory_budget == 0;
+    ctx->inmemory = 0;
+    ctx->buffered = 0;
+    // arenas other threads used for an earlier job are not reused
+    ctx->job = __atomic_add_fetch(&jobs, 1, __ATOMIC_RELAXED);
+    ctx->collectstats = ctx->options.stats || ctx->options.stats_json != NULL;
+    ctx->lockwait = 0;
+}
+
+/**
+ * @brief Runs the map tasks of a job on the pool, one per file or range,
+ * and waits for them. Pinned workers get runs of consecutive tasks, so the
+ * same ranges of the inputs are read on the same node job after job and
+ * their cached pages stay local. With fewer mappers than workers, only
+ * num_mappers workers map at once, each taking tasks as it goes.
+ *
+ * @param map Mapper of the job
+ * @param num_mappers int most map tasks to run at once
+ * @param argc int number of arguments, the files start at argv[1]
+ * @param argv Char pointer array of arguments
+ */
+void RunMapTasks(Mapper map, int num_mappers, int argc, char* argv[]) {
+    ctx->mapthreadargs = MapThreadArgsInit(map, argv + 1, argc - 1);
+    if (num_mappers < ctx->scheduler->num_workers) {
+        ctx->next_maptask = 0;
+        for (int i = 0; i < num_mappers; i++) {
+            SchedulerSubmit(ctx->scheduler, mapper_task, NULL);
+        }
+        SchedulerWait(ctx->scheduler);
+        MapThreadArgsFree(ctx->mapthreadargs);
+        ctx->mapthreadargs = NULL;
+        return;
+    }
+    for (int i = 0; i < ctx->mapthreadargs->numtasks; i++) {
+        int node = -1;
+        if (ctx->topology != NULL) {
+            node = ctx->topology->nodes[(long)i * ctx->topology->num_workers /
+                                        ctx->mapthreadargs->numtasks];
+        }
+        SchedulerSubmitOn(ctx->scheduler, node, map_task,
+                          &ctx->mapthreadargs->tasks[i]);
+    }
+    SchedulerWait(ctx->scheduler);
+    MapThreadArgsFree(ctx->mapthreadargs);
+    ctx->mapthreadargs = NULL;
+}
+
+/**
+ * @brief Hands the stats of a finished job to MR_GetStats and writes them
+ * out when asked to
+ *
+ * @param total_clock Pointer to the StatsClock started with the job
+ */
+void JobStatsFinish(StatsClock* total_clock) {
+    StatsClockStop(total_clock, &ctx->stats.total, ctx->scheduler);
+    ctx->stats.lock_wait = ctx->lockwait / 1e9;
+    if (ctx->options.stats_json != NULL) {
+        StatsWriteJson(&ctx->stats, ctx->options.stats_json);
+    }
+    StatsPublish(&ctx->stats);
+}
+
+void MR_ContextRun(MR_Context* context, int argc, char* argv[], Mapper map,
+                   Reducer reduce, int num_reducers, Partitioner partition,
+                   MR_Options* opts) {
+    ContextRun(context, argc, argv, map, context->scheduler->num_workers,
+               reduce, num_reducers, partition, opts);
+}
+
+/**
+ * @brief Runs a job on a context, with at most num_mappers map tasks and
+ * num_reducers reduce tasks at a time
+ */
+void ContextRun(MR_Context* context, int argc, char* argv[], Mapper map,
+                int num_mappers, Reducer reduce, int num_reducers,
+                Partitioner partition, MR_Options* opts) {
+    MR_Context* saved = ctx;
+
+    ctx = context;
+    JobStart(opts, partition);
+    StatsClock total_clock, phase_clock;
+    if (ctx->collectstats) StatsClockStart(&total_clock, ctx->scheduler);
+
+    // there may be many more partitions than reducers to even out the load
+    int num_partitions = ctx->options.num_partitions;
+    if (num_partitions == MR_AUTO_PARTITIONS) {
+        num_partitions = PARTITIONS_PER_CORE * sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_partitions < num_reducers) num_partitions = num_reducers;
+    } else if (num_partitions <= 0) {
+        num_partitions = num_reducers;
+    }
+
+    // the partitions of the last job are reused when there are as many
+    if (ctx->interhashmap != NULL &&
+        ctx->interhashmap->capacity != num_partitions) {
+        InterMapFree(ctx->interhashmap);
+        ctx->interhashmap = NULL;
+    }
+    if (ctx->interhashmap == NULL) {
+        ctx->interhashmap = InterMapInit(num_partitions);
+    }
+    if (ctx->collectstats) StatsReset(&ctx->stats, num_partitions);
+
+    // the workers' arenas are empty but keep their chunks
+    for (int i = 0; i < ctx->scheduler->num_workers * ctx->num_nodes; i++) {
+        ctx->workerarenas[i]->huge_pages = ctx->options.huge_pages;
+    }
+    ctx->workerbuffers = (EmitBuffers**)malloc(sizeof(EmitBuffers*) *
+                                               ctx->scheduler->num_workers);
+    for (int i = 0; i < ctx->scheduler->num_workers; i++) {
+        ctx->workerbuffers[i] = EmitBuffersInit(ctx->interhashmap->capacity);
+    }
+
+    // mapping phase
+    if (ctx->collectstats) StatsClockStart(&phase_clock, ctx->scheduler);
+    RunMapTasks(map, num_mappers, argc, argv);
+
+    // every worker has to finish sampling before ranges can be cut
+    if (ctx->partitioner == MR_RangePartition) {
+        for (int i = 0; i < ctx->scheduler->num_workers; i++) {
+            EmitBuffersPublishSamples(ctx->workerbuffers[i]);
+        }
+        ComputeSplitPoints(ctx->interhashmap->capacity);
+    }
+    for (int i = 0; i < ctx->scheduler->num_workers; i++) {
+        SchedulerSubmit(ctx->scheduler, flush_task, ctx->workerbuffers[i]);
+    }
+    SchedulerWait(ctx->scheduler);
+    free(ctx->workerbuffers);
+    ctx->workerbuffers = NULL;
+
+    // the samples are only needed to cut the ranges
+    for (size_t i = 0; i < ctx->num_samples; i++) {
+        free(ctx->samples[i].key);
+    }
+    free(ctx->samples);
+    free(ctx->splitpoints);
+    ctx->samples = NULL;
+    ctx->num_samples = 0;
+    ctx->splitpoints = NULL;
+
+    // count the partitions that received pairs
+    for (int i = 0; i < ctx->interhashmap->capacity; i++) {
+        if (ctx->interhashmap->contents[i]->size != 0 ||
+            ctx->interhashmap->contents[i]->num_spills != 0) {
+            ctx->interhashmap->size += 1;
+        }
+    }
+    if (ctx->collectstats) {
+        StatsClockStop(&phase_clock, &ctx->stats.map, ctx->scheduler);
+        for (int i = 0; i < ctx->interhashmap->capacity; i++) {
+            Partition* p = ctx->interhashmap->contents[i];
+            ctx->stats.partition_records[i] = p->size + p->spilled;
+            ctx->stats.partition_bytes[i] = p->bytes;
+            for (int r = 0; r < p->num_spills; r++) {
+                SpillRun* run = &p->spills[r];
+                ctx->stats.partition_bytes[i] += run->end - run->offset;
+            }
+            ctx->stats.shuffled_records += ctx->stats.partition_records[i];
+            ctx->stats.shuffled_bytes += ctx->stats.partition_bytes[i];
+            // the in-memory part gets indexed for sorting
+            ctx->stats.index_bytes += p->size * sizeof(IndexEntry);
+        }
+        StatsClockStart(&phase_clock, ctx->scheduler);
+    }
+
+    // sort every partition, spreading the work over the pool. Pipelined
+    // partitions are mostly merged already and only need their last runs
+    // merged.
+    if (ctx->pipeline) {
+        for (int i = 0; i < ctx->interhashmap->capacity; i++) {
+            SchedulerSubmitOn(ctx->scheduler,
+                              ctx->interhashmap->contents[i]->node,
+                              finish_task, ctx->interhashmap->contents[i]);
+        }
+        SchedulerWait(ctx->scheduler);
+    } else {
+        SortPartitions();
+    }
+    if (ctx->collectstats) {
+        StatsClockStop(&phase_clock, &ctx->stats.sort, ctx->scheduler);
+        StatsClockStart(&phase_clock, ctx->scheduler);
+    }
+
+    // debug_print_interhashmap(interhashmap);
+
+    // reducing phase, num_reducers threads take the partitions biggest first
+    // so that a large one is not left for last, those of their node first
+    ctx->reducetasks = ReduceTasksInit(reduce, &ctx->num_reducetasks);
+    qsort(ctx->reducetasks, ctx->num_reducetasks, sizeof(ReduceTask),
+          reduce_task_cmp);
+    for (int node = 0; node < ctx->num_nodes; node++) {
+        ctx->next_reducetask[node] = ctx->num_reducetasks;
+        ctx->end_reducetask[node] = ctx->num_reducetasks;
+    }
+    for (size_t i = ctx->num_reducetasks; i-- > 0;) {
+        ctx->next_reducetask[ctx->reducetasks[i].node] = i;
+    }
+    for (size_t i = 0; i < ctx->num_reducetasks; i++) {
+        ctx->end_reducetask[ctx->reducetasks[i].node] = i + 1;
+    }
+    for (int i = 0; i < num_reducers && i < ctx->num_reducetasks; i++) {
+        SchedulerSubmit(ctx->scheduler, reducer_task, NULL);
+    }
+    SchedulerWait(ctx->scheduler);
+    if (ctx->collectstats) {
+        StatsClockStop(&phase_clock, &ctx->stats.reduce, ctx->scheduler);
+    }
+    free(ctx->reducetasks);
+    ctx->reducetasks = NULL;
+
+    // debug_print_interhashmap(interhashmap);
+
+    // the job's intermediate pairs all go away at once, the memory they
+    // took stays with the context for the next job
+    InterMapReset(ctx->interhashmap);
+    ArenasFree();
+
+    if (ctx->collectstats) JobStatsFinish(&total_clock);
+    ctx = saved;
+}
+
+MR_Sketch* MR_RunSketch(int argc, char* argv[], Mapper map, int num_mappers,
+                        MR_Options* opts) {
+    MR_Context* context = MR_ContextCreate(num_mappers, opts);
+    MR_Sketch* sketch = MR_ContextRunSketch(context, argc, argv, map, opts);
+    MR_ContextDestroy(context);
+    return sketch;
+}
+
+MR_Sketch* MR_ContextRunSketch(MR_Context* context, int argc, char* argv[],
+                               Mapper map, MR_Options* opts) {
+    MR_Context* saved = ctx;
+    int num_workers = context->scheduler->num_workers;
+
+    ctx = context;
+    JobStart(opts, NULL);
+    StatsClock total_clock, phase_clock;
+    if (ctx->collectstats) {
+        StatsClockStart(&total_clock, ctx->scheduler);
+        StatsReset(&ctx->stats, 0);
+    }
+
+    // every worker counts into its own sketch, so memory stays fixed and
+    // no record is kept
+    ctx->workersketches =
+        (MR_Sketch**)malloc(sizeof(MR_Sketch*) * num_workers);
+    for (int i = 0; i < num_workers; i++) {
+        ctx->workersketches[i] = SketchInit(ctx->options.sketch_epsilon,
+                                            ctx->options.sketch_delta,
+                                            ctx->options.sketch_capacity);
+    }
+    if (ctx->collectstats) StatsClockStart(&phase_clock, ctx->scheduler);
+    RunMapTasks(map, num_workers, argc, argv);
+    if (ctx->collectstats) {
+        StatsClockStop(&phase_clock, &ctx->stats.map, ctx->scheduler);
+    }
+
+    MR_Sketch* sketch = ctx->workersketches[0];
+    for (int i = 1; i < num_workers; i++) {
+        SketchMerge(sketch, ctx->workersketches[i]);
+        MR_SketchFree(ctx->workersketches[i]);
+    }
+    SketchFinish(sketch);
+    free(ctx->workersketches);
+    ctx->workersketches = NULL;
+
+    if (ctx->collectstats) JobStatsFinish(&total_clock);
+    ctx = saved;
+    return sketch;
+}
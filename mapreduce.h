@@ -1,18 +1,193 @@
 #ifndef __mapreduce_h__
 #define __mapreduce_h__
+#include "stddef.h"
 
 // Different function pointer types used by MR
 typedef char *(*Getter)(char *key, int partition_number);
 typedef void (*Mapper)(char *file_name);
+// Maps bytes [offset, offset + length) of a file, which start at the
+// beginning of a line and end right after a newline (or at end of file)
+typedef void (*RangeMapper)(char *file_name, long offset, long length);
 typedef void (*Reducer)(char *key, Getter get_func, int partition_number);
 typedef unsigned long (*Partitioner)(char *key, int num_partitions);
+// Same shape as Reducer, values are pre-aggregated with MR_Emit
+typedef void (*Combiner)(char *key, Getter get_func, int partition_number);
+
+// How the values of a key are brought together for the reducer
+typedef enum {
+    MR_GROUP_SORT = 0,  // keys reach each reducer in sorted order
+    // keys arrive in no particular order and the sort is skipped. Large
+    // partitions are split between workers, so the reducer may be called
+    // for several keys of one partition at once.
+    MR_GROUP_HASH,
+} MR_Grouping;
+
+// MR_Options.num_partitions for a few partitions per core
+#define MR_AUTO_PARTITIONS (-1)
+
+// Optional job settings, zero-initialize for the defaults
+typedef struct {
+    Combiner combine;      // runs on each mapper's output before the shuffle
+    int huge_pages;        // back intermediate storage with huge pages
+    MR_Grouping grouping;  // how values are grouped for the reducer
+    // when set, used instead of the Mapper so that big files are split
+    // between mappers, each call getting about split_size bytes (16MB if 0)
+    RangeMapper map_range;
+    long split_size;
+    // sort each batch of records as mappers hand it over and merge the
+    // sorted runs while the map phase is still going, MR_GROUP_SORT only
+    int pipeline;
+    // bytes of intermediate records kept in memory, 0 for no limit, counting
+    // the segments mappers fill privately. Past it the largest partitions
+    // are sorted and spilled to temp files in spill_dir ($TMPDIR or /tmp if
+    // NULL), and merged back for the reducers; mappers more than an eighth
+    // over it wait for the spill. Each spilled run is read back through a
+    // 64KB buffer, so a budget far below the data costs memory in the merge.
+    // Values read back from disk are only valid until the Getter is called
+    // again. Pipelining is turned off while spilling is possible.
+    // MR_RangePartition stages all records in memory until the split points
+    // are known and ignores the budget.
+    size_t memory_budget;
+    char *spill_dir;
+    // number of partitions (num_reducers if 0). With more partitions than
+    // reducers, num_reducers threads take partitions as they free up, so
+    // partition_number and the Partitioner range over num_partitions.
+    int num_partitions;
+    // collect the numbers MR_GetStats returns, and write them as JSON to
+    // stats_json ("-" for stdout) at the end of the job when it is set
+    int stats;
+    char *stats_json;
+    // pin each worker to a CPU of its own, taking turns between NUMA nodes,
+    // and keep each partition's records on the node of the workers that
+    // sort and reduce it. Read when the workers start, so MR_ContextRun
+    // goes by the options given to MR_ContextCreate. Nodes are only known
+    // when built with -DMR_HAVE_LIBNUMA -lnuma, otherwise this just pins.
+    int pin_threads;
+    // MR_RunSketch only: counts come out at most sketch_epsilon times the
+    // total too high, except with probability sketch_delta (0.001 and 0.01
+    // if 0), and the sketch_capacity heaviest keys (1024 if 0) are tracked
+    // by name. Each worker takes about e / sketch_epsilon * ln(1 /
+    // sketch_delta) counters, whatever the input size.
+    double sketch_epsilon;
+    double sketch_delta;
+    int sketch_capacity;
+} MR_Options;
+
+typedef struct {
+    double wall;  // seconds
+    double cpu;   // CPU seconds of the caller and the context's workers
+} MR_PhaseTime;
+
+// Numbers of the last job run with MR_Options.stats or stats_json set
+typedef struct {
+    MR_PhaseTime map;  // map tasks and handing their output over
+    MR_PhaseTime sort;
+    MR_PhaseTime reduce;
+    MR_PhaseTime total;
+    size_t emitted_records;  // pairs emitted by mappers, before combining
+    size_t emitted_bytes;    // key and value bytes of those pairs
+    size_t shuffled_records;  // records that reached the partitions
+    size_t shuffled_bytes;    // bytes they take, headers and padding included
+    size_t spilled_records;
+    size_t spilled_bytes;
+    double lock_wait;    // seconds threads spent waiting for locks
+    size_t arena_bytes;  // arena memory the job's intermediate records took
+    size_t index_bytes;  // memory taken by the sort indexes
+    int num_partitions;
+    size_t *partition_records;  // shuffled records of every partition
+    size_t *partition_bytes;
+} MR_Stats;
 
 // External functions: these are what you must define
 void MR_Emit(char *key, char *value);
+// Keys and values of any bytes, NULs included. Records are compared with
+// memcmp, shorter first on a tie. MR_RangePartition and custom partitioners
+// still see the key as a C string, so it ends at its first NUL for them.
+void MR_EmitBytes(char *key, size_t key_len, char *value, size_t value_len);
+// Stores the value in as few bytes as it needs instead of as text. Every
+// value of a key has to be emitted the same way.
+void MR_EmitInt(char *key, long value);
+
+// Reads the next value of a key emitted with MR_EmitInt, returns 0 when
+// there are none left
+int MR_GetInt(Getter get_func, char *key, int partition_number, long *value);
+// Length of the value the Getter returned last, and of the current key
+size_t MR_ValueLength(void);
+size_t MR_CurrentKeyLength(void);
+
+// Splits text into tokens separated by spaces, tabs, \r and \n, scanning
+// 16 or 32 bytes at a time where SSE2 or AVX2 is available
+typedef struct {
+    char *pos;
+    char *end;
+} MR_Tokenizer;
+
+void MR_TokenizerInit(MR_Tokenizer *t, char *text, size_t len);
+// Returns the next token and its length, NULL when the text is used up.
+// The byte after a token may be overwritten, e.g. with a NUL for MR_Emit.
+char *MR_NextToken(MR_Tokenizer *t, size_t *len);
 
 unsigned long MR_DefaultHashPartition(char *key, int num_partitions);
 
+// Stats of the last job the calling thread ran, valid until it runs another
+MR_Stats *MR_GetStats(void);
+
+// Hash of the key being reduced (or combined), the same value Hash() in
+// hashmap.h gives, so reducers can hand it to the *Hashed map calls
+unsigned long MR_CurrentKeyHash(void);
+
+// Samples keys during the map phase and splits the key space into ranges
+// with balanced record and byte counts. Partition i only holds keys that
+// sort before those of partition i + 1, so reducer output is globally
+// ordered. Pass it to MR_Run as the partitioner to enable it.
+unsigned long MR_RangePartition(char *key, int num_partitions);
+
 void MR_Run(int argc, char *argv[], Mapper map, int num_mappers, Reducer reduce,
             int num_reducers, Partitioner partition);
 
+void MR_RunWithOptions(int argc, char *argv[], Mapper map, int num_mappers,
+                       Reducer reduce, int num_reducers, Partitioner partition,
+                       MR_Options *options);
+
+// Approximate counts in fixed memory and a single pass. Every mapper keeps
+// a Count-Min sketch of all keys and a Space-Saving summary of the heaviest
+// ones, merged once the map tasks are done, and nothing is shuffled, sorted
+// or reduced. A pair emitted with MR_Emit or MR_EmitBytes counts 1 for its
+// key, one emitted with MR_EmitInt counts its value (if above 0).
+typedef struct MR_Sketch MR_Sketch;
+
+typedef struct {
+    char *key;  // NUL terminated, valid until MR_SketchFree
+    size_t key_len;
+    unsigned long count;  // never below the true count
+    unsigned long error;  // count - error is never above it
+} MR_HeavyHitter;
+
+MR_Sketch *MR_RunSketch(int argc, char *argv[], Mapper map, int num_mappers,
+                        MR_Options *options);
+// Estimated count of a key, never below the true one
+unsigned long MR_SketchCount(MR_Sketch *sketch, char *key, size_t key_len);
+// Fills `out` with the k heaviest keys, heaviest first, and returns how many
+// there were. No more than sketch_capacity are known.
+int MR_SketchTopK(MR_Sketch *sketch, int k, MR_HeavyHitter *out);
+// Sum of the counts of all keys
+unsigned long MR_SketchTotal(MR_Sketch *sketch);
+void MR_SketchFree(MR_Sketch *sketch);
+
+// A pool of worker threads and the memory of the jobs run on it, both kept
+// from one job to the next. A context runs one job at a time, jobs on
+// different contexts may run at once.
+typedef struct MR_Context MR_Context;
+
+// Only options->pin_threads is looked at, options may be NULL
+MR_Context *MR_ContextCreate(int num_workers, MR_Options *options);
+// Like MR_RunWithOptions, every worker maps and at most num_reducers of them
+// reduce at once
+void MR_ContextRun(MR_Context *context, int argc, char *argv[], Mapper map,
+                   Reducer reduce, int num_reducers, Partitioner partition,
+                   MR_Options *options);
+MR_Sketch *MR_ContextRunSketch(MR_Context *context, int argc, char *argv[],
+                               Mapper map, MR_Options *options);
+void MR_ContextDestroy(MR_Context *context);
+
 #endif  // __mapreduce_h__
@@ -0,0 +1,271 @@
+#include "scheduler.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// index of the calling thread in its pool, -1 outside of any pool
+__thread int workerid = -1;
+
+typedef struct {
+    Scheduler* scheduler;
+    int id;
+} WorkerArgs;
+
+void deque_push(TaskDeque* deque, Task task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->size == deque->capacity) {
+        // unroll the circular buffer into one twice as large
+        Task* tasks = (Task*)malloc(sizeof(Task) * deque->capacity * 2);
+        if (tasks == NULL) {
+            printf("Malloc error! %s\n", strerror(errno));
+            exit(1);
+        }
+        for (size_t i = 0; i < deque->size; i++) {
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity *= 2;
+        deque->head = 0;
+    }
+    deque->tasks[(deque->head + deque->size) % deque->capacity] = task;
+    deque->size += 1;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+/**
+ * @brief Takes a task from a deque, the newest one for its owner and the
+ * oldest one for a thief
+ *
+ * @param deque Pointer to TaskDeque
+ * @param steal int nonzero when taking from another worker's deque
+ * @param task Pointer receiving the task
+ * @return int 1 if a task was taken, 0 if the deque was empty
+ */
+int deque_take(TaskDeque* deque, int steal, Task* task) {
+    int found = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->size != 0) {
+        if (steal) {
+            *task = deque->tasks[deque->head];
+            deque->head = (deque->head + 1) % deque->capacity;
+        } else {
+            *task = deque->tasks[(deque->head + deque->size - 1) %
+                                 deque->capacity];
+        }
+        deque->size -= 1;
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/**
+ * @brief Finds a task for a worker, its own deque first, then those of the
+ * workers on its node, then the others
+ *
+ * @param scheduler Pointer to Scheduler
+ * @param id int worker looking for work
+ * @param task Pointer receiving the task
+ * @return int 1 if a task was found
+ */
+int scheduler_take(Scheduler* scheduler, int id, Task* task) {
+    for (int remote = 0; remote < 2; remote++) {
+        for (int i = 0; i < scheduler->num_workers; i++) {
+            int victim = (id + i) % scheduler->num_workers;
+            if ((scheduler->nodes[victim] != scheduler->nodes[id]) !=
+                remote) {
+                continue;
+            }
+            if (deque_take(&scheduler->deques[victim], i != 0, task)) {
+                __atomic_sub_fetch(&scheduler->queued, 1, __ATOMIC_ACQ_REL);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void* worker_threads(void* args) {
+    Scheduler* scheduler = ((WorkerArgs*)args)->scheduler;
+    int id = ((WorkerArgs*)args)->id;
+    Task task;
+
+    free(args);
+    workerid = id;
+    if (scheduler->start != NULL) {
+        (*scheduler->start)(scheduler->start_arg);
+    }
+    for (;;) {
+        if (scheduler_take(scheduler, id, &task)) {
+            (*task.func)(task.arg);
+            if (__atomic_sub_fetch(&scheduler->pending, 1, __ATOMIC_ACQ_REL) ==
+                0) {
+                pthread_mutex_lock(&scheduler->lock);
+                pthread_cond_broadcast(&scheduler->done);
+                pthread_mutex_unlock(&scheduler->lock);
+            }
+            continue;
+        }
+
+        // nothing to run or steal, sleep until a task is queued
+        pthread_mutex_lock(&scheduler->lock);
+        while (__atomic_load_n(&scheduler->queued, __ATOMIC_ACQUIRE) == 0 &&
+               !scheduler->shutdown) {
+            pthread_cond_wait(&scheduler->work, &scheduler->lock);
+        }
+        if (scheduler->shutdown) {
+            pthread_mutex_unlock(&scheduler->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+}
+
+/**
+ * @brief Starts a pool of `num_workers` threads that run submitted tasks,
+ * idle workers stealing from busy ones
+ *
+ * @param num_workers int number of worker threads, at least 1
+ * @param nodes int array of the NUMA node of each worker, NULL for one node
+ * @param start TaskFunc every worker runs once when it starts, may be NULL
+ * @param start_arg Void pointer passed to start
+ * @return Scheduler* Pointer to Scheduler
+ */
+Scheduler* SchedulerInit(int num_workers, const int* nodes, TaskFunc start,
+                         void* start_arg) {
+    Scheduler* scheduler = (Scheduler*)calloc(1, sizeof(Scheduler));
+    if (num_workers < 1) num_workers = 1;
+    scheduler->num_workers = num_workers;
+    scheduler->nodes = (int*)calloc(num_workers, sizeof(int));
+    if (nodes != NULL) {
+        memcpy(scheduler->nodes, nodes, sizeof(int) * num_workers);
+    }
+    scheduler->start = start;
+    scheduler->start_arg = start_arg;
+    scheduler->deques = (TaskDeque*)calloc(num_workers, sizeof(TaskDeque));
+    scheduler->threads = (pthread_t*)malloc(sizeof(pthread_t) * num_workers);
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->work, NULL);
+    pthread_cond_init(&scheduler->done, NULL);
+
+    for (int i = 0; i < num_workers; i++) {
+        TaskDeque* deque = &scheduler->deques[i];
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->capacity = DEQUE_INIT_CAPACITY;
+        deque->tasks = (Task*)malloc(sizeof(Task) * deque->capacity);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        WorkerArgs* args = (WorkerArgs*)malloc(sizeof(WorkerArgs));
+        args->scheduler = scheduler;
+        args->id = i;
+        if (pthread_create(&scheduler->threads[i], NULL, &worker_threads,
+                           args) != 0) {
+            printf("something went wrong STARTING WORKERS\n");
+            exit(1);
+        }
+    }
+    return scheduler;
+}
+
+/**
+ * @brief Queues a task. Workers queue on their own deque, other threads
+ * spread their tasks over all of them.
+ *
+ * @param scheduler Pointer to Scheduler
+ * @param func TaskFunc to run
+ * @param arg Void pointer passed to func
+ */
+void SchedulerSubmit(Scheduler* scheduler, TaskFunc func, void* arg) {
+    SchedulerSubmitOn(scheduler, -1, func, arg);
+}
+
+/**
+ * @brief Queues a task for the workers of one NUMA node. A worker of that
+ * node queues it on its own deque, anyone else on the deque of the node's
+ * next worker in turn. Idle workers of other nodes may still steal it.
+ *
+ * @param scheduler Pointer to Scheduler
+ * @param node int NUMA node, -1 for any (like SchedulerSubmit)
+ * @param func TaskFunc to run
+ * @param arg Void pointer passed to func
+ */
+void SchedulerSubmitOn(Scheduler* scheduler, int node, TaskFunc func,
+                       void* arg) {
+    Task task = {func, arg};
+    int id = workerid;
+
+    __atomic_add_fetch(&scheduler->pending, 1, __ATOMIC_ACQ_REL);
+    if (id < 0 || id >= scheduler->num_workers ||
+        (node >= 0 && scheduler->nodes[id] != node)) {
+        pthread_mutex_lock(&scheduler->lock);
+        id = scheduler->next;
+        // a node without workers falls back to the next one in turn
+        for (int i = 0; node >= 0 && i < scheduler->num_workers; i++) {
+            int candidate = (scheduler->next + i) % scheduler->num_workers;
+            if (scheduler->nodes[candidate] == node) {
+                id = candidate;
+                break;
+            }
+        }
+        scheduler->next = (id + 1) % scheduler->num_workers;
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+    deque_push(&scheduler->deques[id], task);
+    __atomic_add_fetch(&scheduler->queued, 1, __ATOMIC_ACQ_REL);
+
+    pthread_mutex_lock(&scheduler->lock);
+    pthread_cond_signal(&scheduler->work);
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+/**
+ * @brief Blocks until every submitted task has finished, must not be called
+ * from a worker
+ *
+ * @param scheduler Pointer to Scheduler
+ */
+void SchedulerWait(Scheduler* scheduler) {
+    pthread_mutex_lock(&scheduler->lock);
+    while (__atomic_load_n(&scheduler->pending, __ATOMIC_ACQUIRE) != 0) {
+        pthread_cond_wait(&scheduler->done, &scheduler->lock);
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+/**
+ * @brief Index of the calling worker, -1 when not called from a pool
+ */
+int SchedulerWorkerId(void) { return workerid; }
+
+/**
+ * @brief Stops the workers once they are idle and frees the pool
+ *
+ * @param scheduler Pointer to Scheduler
+ */
+void SchedulerFree(Scheduler* scheduler) {
+    SchedulerWait(scheduler);
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->shutdown = 1;
+    pthread_cond_broadcast(&scheduler->work);
+    pthread_mutex_unlock(&scheduler->lock);
+
+    for (int i = 0; i < scheduler->num_workers; i++) {
+        pthread_join(scheduler->threads[i], NULL);
+    }
+    // workers look into every deque, so none goes before all have exited
+    for (int i = 0; i < scheduler->num_workers; i++) {
+        pthread_mutex_destroy(&scheduler->deques[i].lock);
+        free(scheduler->deques[i].tasks);
+    }
+    pthread_mutex_destroy(&scheduler->lock);
+    pthread_cond_destroy(&scheduler->work);
+    pthread_cond_destroy(&scheduler->done);
+    free(scheduler->deques);
+    free(scheduler->nodes);
+    free(scheduler->threads);
+    free(scheduler);
+}
@@ -0,0 +1,52 @@
+#ifndef __scheduler_h__
+#define __scheduler_h__
+#include <pthread.h>
+
+#include "stddef.h"
+
+#define DEQUE_INIT_CAPACITY 64
+
+typedef void (*TaskFunc)(void* arg);
+
+typedef struct {
+    TaskFunc func;
+    void* arg;
+} Task;
+
+// Per-worker queue. The owner pushes and pops at the tail, idle workers
+// steal the oldest task from the head.
+typedef struct {
+    pthread_mutex_t lock;
+    Task* tasks;  // circular buffer
+    size_t capacity;
+    size_t head;
+    size_t size;
+} TaskDeque;
+
+typedef struct {
+    TaskDeque* deques;  // one per worker
+    pthread_t* threads;
+    int num_workers;
+    int* nodes;      // NUMA node of each worker, thieves try their own first
+    int next;        // deque receiving the next task from outside the pool
+    size_t queued;   // tasks sitting in the deques
+    size_t pending;  // tasks submitted and not finished yet
+    int shutdown;
+    TaskFunc start;  // run by every worker before it takes any task
+    void* start_arg;
+    pthread_mutex_t lock;  // guards sleeping, waking and next
+    pthread_cond_t work;   // signalled when a task is queued
+    pthread_cond_t done;   // signalled when pending drops to 0
+} Scheduler;
+
+// External Functions
+Scheduler* SchedulerInit(int num_workers, const int* nodes, TaskFunc start,
+                         void* start_arg);
+void SchedulerSubmit(Scheduler* scheduler, TaskFunc func, void* arg);
+void SchedulerSubmitOn(Scheduler* scheduler, int node, TaskFunc func,
+                       void* arg);
+void SchedulerWait(Scheduler* scheduler);
+int SchedulerWorkerId(void);
+void SchedulerFree(Scheduler* scheduler);
+
+#endif  // __scheduler_h__
@@ -9,6 +9,8 @@
 struct kv {
     char* key;
     char* value;
+    size_t key_len;
+    size_t value_len;
 };
 
 struct kv_list {
@@ -19,6 +21,10 @@ struct kv_list {
 
 struct kv_list kvl;
 size_t kvl_counter;
+// pair whose key is being reduced, and the length of the value get_func
+// returned last
+struct kv* current;
+size_t value_len;
 
 void init_kv_list(size_t size) {
     kvl.elements = (struct kv**)malloc(size * sizeof(struct kv*));
@@ -39,36 +45,104 @@ char* get_func(char* key, int partition_number) {
         return NULL;
     }
     struct kv* curr_elt = kvl.elements[kvl_counter];
-    if (!strcmp(curr_elt->key, key)) {
+    // keys may hold NUL bytes, so they are compared with the current one
+    if (curr_elt->key_len == current->key_len &&
+        !memcmp(curr_elt->key, current->key, current->key_len)) {
         kvl_counter++;
+        value_len = curr_elt->value_len;
         return curr_elt->value;
     }
     return NULL;
 }
 
 int cmp(const void* a, const void* b) {
-    char* str1 = (*(struct kv**)a)->key;
-    char* str2 = (*(struct kv**)b)->key;
-    return strcmp(str1, str2);
+    struct kv* e1 = *(struct kv**)a;
+    struct kv* e2 = *(struct kv**)b;
+    int c = memcmp(e1->key, e2->key,
+                   e1->key_len < e2->key_len ? e1->key_len : e2->key_len);
+    if (c != 0) return c;
+    return e1->key_len < e2->key_len ? -1 : e1->key_len > e2->key_len;
 }
 
-void MR_Emit(char* key, char* value) {
+char* copy_bytes(char* data, size_t len) {
+    char* copy = (char*)malloc(len + 1);
+    if (copy == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    memcpy(copy, data, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void MR_EmitBytes(char* key, size_t key_len, char* value, size_t value_len) {
     struct kv* elt = (struct kv*)malloc(sizeof(struct kv));
     if (elt == NULL) {
         printf("Malloc error! %s\n", strerror(errno));
         exit(1);
     }
-    elt->key = strdup(key);
-    elt->value = strdup(value);
+    elt->key = copy_bytes(key, key_len);
+    elt->value = copy_bytes(value, value_len);
+    elt->key_len = key_len;
+    elt->value_len = value_len;
     add_to_list(elt);
+}
+
+void MR_Emit(char* key, char* value) {
+    MR_EmitBytes(key, strlen(key), value, strlen(value));
+}
 
-    return;
+void MR_EmitInt(char* key, long value) {
+    // same encoding as mapreduce.c, little-endian without sign bytes
+    char buf[sizeof(long)];
+    size_t len = 1;
+
+    for (size_t i = 0; i < sizeof(long); i++) {
+        buf[i] = (char)((unsigned long)value >> (8 * i));
+    }
+    while (len < sizeof(long) && (value >> (8 * len - 1) != 0 &&
+                                  value >> (8 * len - 1) != -1)) {
+        len++;
+    }
+    MR_EmitBytes(key, strlen(key), buf, len);
+}
+
+int MR_GetInt(Getter get_func, char* key, int partition_number, long* value) {
+    unsigned char* p = (unsigned char*)(*get_func)(key, partition_number);
+    size_t len = value_len;
+
+    if (p == NULL) return 0;
+    *value = len != 0 && (p[len - 1] & 0x80) ? -1 : 0;
+    while (len-- > 0) {
+        *value = (long)(((unsigned long)*value << 8) | p[len]);
+    }
+    return 1;
+}
+
+size_t MR_ValueLength(void) { return value_len; }
+
+size_t MR_CurrentKeyLength(void) { return current->key_len; }
+
+unsigned long MR_CurrentKeyHash(void) {
+    return HashBytes(current->key, current->key_len);
 }
 
 unsigned long MR_DefaultHashPartition(char* key, int num_partitions) {
     return 0;
 }
 
+void sort_and_reduce(Reducer reduce) {
+    qsort(kvl.elements, kvl.num_elements, sizeof(struct kv*), cmp);
+
+    // note that in the single-threaded version, we don't really have
+    // partitions. We just use a global counter to keep it really simple
+    kvl_counter = 0;
+    while (kvl_counter < kvl.num_elements) {
+        current = kvl.elements[kvl_counter];
+        (*reduce)(current->key, get_func, 0);
+    }
+}
+
 void MR_Run(int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce,
             int num_reducers, Partitioner partition) {
     init_kv_list(10);
@@ -76,13 +150,21 @@ void MR_Run(int argc, char* argv[], Mapper map, int num_mappers, Reducer reduce,
     for (i = 1; i < argc; i++) {
         (*map)(argv[i]);
     }
+    sort_and_reduce(reduce);
+}
 
-    qsort(kvl.elements, kvl.num_elements, sizeof(struct kv*), cmp);
-
-    // note that in the single-threaded version, we don't really have
-    // partitions. We just use a global counter to keep it really simple
-    kvl_counter = 0;
-    while (kvl_counter < kvl.num_elements) {
-        (*reduce)((kvl.elements[kvl_counter])->key, get_func, 0);
+void MR_RunWithOptions(int argc, char* argv[], Mapper map, int num_mappers,
+                       Reducer reduce, int num_reducers, Partitioner partition,
+                       MR_Options* opts) {
+    // a single thread and a single sorted list, the range mapper is the
+    // only option that changes anything here
+    if (opts == NULL || opts->map_range == NULL) {
+        MR_Run(argc, argv, map, num_mappers, reduce, num_reducers, partition);
+        return;
+    }
+    init_kv_list(10);
+    for (int i = 1; i < argc; i++) {
+        (*opts->map_range)(argv[i], 0, -1);
     }
+    sort_and_reduce(reduce);
 }
@@ -0,0 +1,353 @@
+#include "sketch.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+
+void* sketch_alloc(size_t size) {
+    void* p = calloc(1, size);
+    if (p == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    return p;
+}
+
+/**
+ * @brief Initializes an empty sketch. Counts come out at most epsilon times
+ * the total weight too high, except with probability delta, and the
+ * `capacity` heaviest keys are tracked by name.
+ *
+ * @param epsilon double error bound as a fraction of the total weight
+ * @param delta double probability of going over it
+ * @param capacity int number of heavy hitters kept
+ * @return MR_Sketch* Pointer to MR_Sketch
+ */
+MR_Sketch* SketchInit(double epsilon, double delta, int capacity) {
+    MR_Sketch* sketch = (MR_Sketch*)sketch_alloc(sizeof(MR_Sketch));
+    double miss = 1.0;
+
+    if (epsilon <= 0) epsilon = SKETCH_DEFAULT_EPSILON;
+    if (delta <= 0) delta = SKETCH_DEFAULT_DELTA;
+    if (capacity <= 0) capacity = SKETCH_DEFAULT_CAPACITY;
+
+    // e / epsilon counters per row and ln(1 / delta) rows
+    sketch->width = 1;
+    while (sketch->width < 2.718281828 / epsilon) sketch->width *= 2;
+    while (miss > delta) {
+        miss /= 2.718281828;
+        sketch->depth += 1;
+    }
+    sketch->cm = (unsigned long*)sketch_alloc(sizeof(unsigned long) *
+                                              sketch->depth * sketch->width);
+
+    sketch->capacity = capacity;
+    sketch->counters =
+        (SketchCounter*)sketch_alloc(sizeof(SketchCounter) * capacity);
+    // kept at most half full
+    size_t slots = 1;
+    while (slots < 2 * (size_t)capacity) slots *= 2;
+    sketch->table = (int*)malloc(sizeof(int) * slots);
+    if (sketch->table == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    memset(sketch->table, -1, sizeof(int) * slots);
+    sketch->table_mask = slots - 1;
+    return sketch;
+}
+
+/**
+ * @brief Counter of row `row` a key hashes to. Each row remixes the key's
+ * hash with a seed of its own, so keys that collide in one row rarely do in
+ * the others.
+ */
+size_t sketch_cell(MR_Sketch* sketch, unsigned long hash, int row) {
+    unsigned long mixed = hash_mix(hash ^ (HASH_SEED * (row + 1)), HASH_MUL);
+    return row * sketch->width + (mixed & (sketch->width - 1));
+}
+
+unsigned long sketch_estimate(MR_Sketch* sketch, unsigned long hash) {
+    unsigned long estimate = sketch->cm[sketch_cell(sketch, hash, 0)];
+    for (int row = 1; row < sketch->depth; row++) {
+        unsigned long count = sketch->cm[sketch_cell(sketch, hash, row)];
+        if (count < estimate) estimate = count;
+    }
+    return estimate;
+}
+
+/**
+ * @brief Finds the counter of a key
+ *
+ * @return int index of the counter, -1 if the key has none
+ */
+int sketch_lookup(MR_Sketch* sketch, unsigned long hash, const char* key,
+                  size_t key_len) {
+    for (size_t slot = hash & sketch->table_mask;
+         sketch->table[slot] != -1; slot = (slot + 1) & sketch->table_mask) {
+        SketchCounter* c = &sketch->counters[sketch->table[slot]];
+        if (c->hash == hash && c->hh.key_len == key_len &&
+            memcmp(c->hh.key, key, key_len) == 0) {
+            return sketch->table[slot];
+        }
+    }
+    return -1;
+}
+
+void table_insert(MR_Sketch* sketch, int i) {
+    size_t slot = sketch->counters[i].hash & sketch->table_mask;
+    while (sketch->table[slot] != -1) slot = (slot + 1) & sketch->table_mask;
+    sketch->table[slot] = i;
+    sketch->counters[i].slot = slot;
+}
+
+/**
+ * @brief Empties a table slot, moving later entries of the probe sequence
+ * back so lookups never stop short at the hole
+ */
+void table_remove(MR_Sketch* sketch, size_t slot) {
+    size_t mask = sketch->table_mask;
+
+    sketch->table[slot] = -1;
+    for (size_t j = (slot + 1) & mask; sketch->table[j] != -1;
+         j = (j + 1) & mask) {
+        int i = sketch->table[j];
+        size_t home = sketch->counters[i].hash & mask;
+        // the entry may move unless its home lies between the hole and j
+        if (((j - home) & mask) >= ((j - slot) & mask)) {
+            sketch->table[slot] = i;
+            sketch->counters[i].slot = slot;
+            sketch->table[j] = -1;
+            slot = j;
+        }
+    }
+}
+
+void heap_swap(MR_Sketch* sketch, int a, int b) {
+    SketchCounter tmp = sketch->counters[a];
+    sketch->counters[a] = sketch->counters[b];
+    sketch->counters[b] = tmp;
+    sketch->table[sketch->counters[a].slot] = a;
+    sketch->table[sketch->counters[b].slot] = b;
+}
+
+void heap_sift_up(MR_Sketch* sketch, int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (sketch->counters[parent].hh.count <= sketch->counters[i].hh.count) {
+            break;
+        }
+        heap_swap(sketch, parent, i);
+        i = parent;
+    }
+}
+
+void heap_sift_down(MR_Sketch* sketch, int i) {
+    for (;;) {
+        int smallest = i;
+        for (int child = 2 * i + 1; child <= 2 * i + 2; child++) {
+            if (child < sketch->size &&
+                sketch->counters[child].hh.count <
+                    sketch->counters[smallest].hh.count) {
+                smallest = child;
+            }
+        }
+        if (smallest == i) return;
+        heap_swap(sketch, i, smallest);
+        i = smallest;
+    }
+}
+
+/**
+ * @brief Adds `weight` to a key. A key without a counter takes over the
+ * smallest one once all are in use, inheriting its count as error.
+ *
+ * @param sketch Pointer to MR_Sketch
+ * @param hash unsigned long HashBytes of the key
+ * @param key Char pointer to key
+ * @param key_len size_t key length
+ * @param weight unsigned long amount to add
+ */
+void SketchAdd(MR_Sketch* sketch, unsigned long hash, const char* key,
+               size_t key_len, unsigned long weight) {
+    int i;
+
+    sketch->total += weight;
+    for (int row = 0; row < sketch->depth; row++) {
+        sketch->cm[sketch_cell(sketch, hash, row)] += weight;
+    }
+
+    i = sketch_lookup(sketch, hash, key, key_len);
+    if (i >= 0) {
+        sketch->counters[i].hh.count += weight;
+        heap_sift_down(sketch, i);
+        return;
+    }
+
+    int fresh = sketch->size < sketch->capacity;
+    SketchCounter* c;
+    if (fresh) {
+        i = sketch->size++;
+        c = &sketch->counters[i];
+        c->hh.key = NULL;
+        c->hh.count = 0;
+    } else {
+        i = 0;
+        c = &sketch->counters[0];
+        table_remove(sketch, c->slot);
+    }
+    c->hh.key = (char*)realloc(c->hh.key, key_len + 1);
+    if (c->hh.key == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    memcpy(c->hh.key, key, key_len);
+    c->hh.key[key_len] = '\0';
+    c->hh.key_len = key_len;
+    c->hh.error = c->hh.count;
+    c->hh.count += weight;
+    c->hash = hash;
+    table_insert(sketch, i);
+    if (fresh) {
+        heap_sift_up(sketch, i);
+    } else {
+        heap_sift_down(sketch, i);
+    }
+}
+
+int counter_cmp(const void* a, const void* b) {
+    const MR_HeavyHitter* h1 = &((SketchCounter*)a)->hh;
+    const MR_HeavyHitter* h2 = &((SketchCounter*)b)->hh;
+    if (h1->count != h2->count) return h1->count > h2->count ? -1 : 1;
+    return h1->error < h2->error ? -1 : h1->error > h2->error;
+}
+
+void table_rebuild(MR_Sketch* sketch) {
+    memset(sketch->table, -1, sizeof(int) * (sketch->table_mask + 1));
+    for (int i = 0; i < sketch->size; i++) table_insert(sketch, i);
+}
+
+/**
+ * @brief Adds another worker's sketch into this one. A key missing from one
+ * summary may still have up to that summary's smallest count, so that much
+ * is added to its count and to its error. The heaviest `capacity` counters
+ * are kept. `other` is left empty and must have the same dimensions.
+ *
+ * @param sketch Pointer to MR_Sketch receiving the counts
+ * @param other Pointer to MR_Sketch being merged in
+ */
+void SketchMerge(MR_Sketch* sketch, MR_Sketch* other) {
+    size_t cells = (size_t)sketch->depth * sketch->width;
+    int n = 0;
+
+    for (size_t i = 0; i < cells; i++) sketch->cm[i] += other->cm[i];
+    sketch->total += other->total;
+
+    // smallest counts, the heaps still have them on top
+    unsigned long min = sketch->size == sketch->capacity
+                            ? sketch->counters[0].hh.count
+                            : 0;
+    unsigned long other_min = other->size == other->capacity
+                                  ? other->counters[0].hh.count
+                                  : 0;
+    SketchCounter* merged = (SketchCounter*)sketch_alloc(
+        sizeof(SketchCounter) * (sketch->size + other->size));
+
+    for (int i = 0; i < sketch->size; i++) {
+        SketchCounter* c = &sketch->counters[i];
+        int j = sketch_lookup(other, c->hash, c->hh.key, c->hh.key_len);
+        if (j >= 0) {
+            c->hh.count += other->counters[j].hh.count;
+            c->hh.error += other->counters[j].hh.error;
+            // counted now, the table no longer needs the slot
+            other->counters[j].slot = (size_t)-1;
+        } else {
+            c->hh.count += other_min;
+            c->hh.error += other_min;
+        }
+        merged[n++] = *c;
+    }
+    for (int j = 0; j < other->size; j++) {
+        SketchCounter* c = &other->counters[j];
+        if (c->slot == (size_t)-1) {
+            free(c->hh.key);
+            continue;
+        }
+        c->hh.count += min;
+        c->hh.error += min;
+        merged[n++] = *c;
+    }
+    other->size = 0;
+
+    qsort(merged, n, sizeof(SketchCounter), counter_cmp);
+    for (int i = sketch->capacity; i < n; i++) free(merged[i].hh.key);
+    sketch->size = n < sketch->capacity ? n : sketch->capacity;
+    // ascending order is a valid min-heap
+    for (int i = 0; i < sketch->size; i++) {
+        sketch->counters[i] = merged[sketch->size - 1 - i];
+    }
+    free(merged);
+    table_rebuild(sketch);
+}
+
+/**
+ * @brief Tightens every counter with the Count-Min estimate of its key and
+ * orders them heaviest first for MR_SketchTopK. No more keys can be added
+ * after this.
+ *
+ * @param sketch Pointer to MR_Sketch
+ */
+void SketchFinish(MR_Sketch* sketch) {
+    // the smallest counter, still on top of the heap, bounds every key that
+    // lost its counter or never had one
+    if (sketch->size == sketch->capacity) {
+        sketch->floor = sketch->counters[0].hh.count;
+    }
+    for (int i = 0; i < sketch->size; i++) {
+        MR_HeavyHitter* hh = &sketch->counters[i].hh;
+        unsigned long estimate =
+            sketch_estimate(sketch, sketch->counters[i].hash);
+        // both are upper bounds, the lower bound count - error stays
+        if (estimate < hh->count) {
+            unsigned long cut = hh->count - estimate;
+            hh->error = hh->error > cut ? hh->error - cut : 0;
+            hh->count = estimate;
+        }
+    }
+    qsort(sketch->counters, sketch->size, sizeof(SketchCounter), counter_cmp);
+    table_rebuild(sketch);
+}
+
+unsigned long MR_SketchCount(MR_Sketch* sketch, char* key, size_t key_len) {
+    unsigned long hash = HashBytes(key, key_len);
+    unsigned long estimate = sketch_estimate(sketch, hash);
+    unsigned long bound = estimate;
+    int i = sketch_lookup(sketch, hash, key, key_len);
+
+    // the summary bounds a key from above too, tracked or not
+    if (i >= 0) {
+        bound = sketch->counters[i].hh.count;
+    } else if (sketch->size == sketch->capacity) {
+        bound = sketch->floor;
+    }
+    return bound < estimate ? bound : estimate;
+}
+
+int MR_SketchTopK(MR_Sketch* sketch, int k, MR_HeavyHitter* out) {
+    int n = k < sketch->size ? k : sketch->size;
+    for (int i = 0; i < n; i++) out[i] = sketch->counters[i].hh;
+    return n;
+}
+
+unsigned long MR_SketchTotal(MR_Sketch* sketch) { return sketch->total; }
+
+void MR_SketchFree(MR_Sketch* sketch) {
+    for (int i = 0; i < sketch->size; i++) free(sketch->counters[i].hh.key);
+    free(sketch->counters);
+    free(sketch->table);
+    free(sketch->cm);
+    free(sketch);
+}
@@ -0,0 +1,43 @@
+#ifndef __sketch_h__
+#define __sketch_h__
+#include "mapreduce.h"
+#include "stddef.h"
+
+// defaults for the MR_Options sketch fields left at 0
+#define SKETCH_DEFAULT_EPSILON 0.001
+#define SKETCH_DEFAULT_DELTA 0.01
+#define SKETCH_DEFAULT_CAPACITY 1024
+
+typedef struct {
+    MR_HeavyHitter hh;
+    unsigned long hash;
+    size_t slot;  // where the table points at this counter
+} SketchCounter;
+
+// Count-Min sketch of every key next to a Space-Saving summary of the
+// heaviest ones. Each worker fills its own, they are merged at the end.
+struct MR_Sketch {
+    // depth rows of width counters, width a power of two
+    unsigned long* cm;
+    int depth;
+    size_t width;
+    unsigned long total;  // sum of every weight added
+    // min-heap on count until SketchFinish sorts it heaviest first
+    SketchCounter* counters;
+    int capacity;
+    int size;
+    // no untracked key has more, set by SketchFinish once size == capacity
+    unsigned long floor;
+    // open addressing from key hash to counter, -1 for an empty slot
+    int* table;
+    size_t table_mask;
+};
+
+// Internal Functions
+MR_Sketch* SketchInit(double epsilon, double delta, int capacity);
+void SketchAdd(MR_Sketch* sketch, unsigned long hash, const char* key,
+               size_t key_len, unsigned long weight);
+void SketchMerge(MR_Sketch* sketch, MR_Sketch* other);
+void SketchFinish(MR_Sketch* sketch);
+
+#endif  // __sketch_h__
@@ -0,0 +1,162 @@
+#include "stats.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// stats of the last job the thread ran, handed out by MR_GetStats
+__thread MR_Stats laststats;
+// frees laststats when its thread exits
+pthread_key_t laststats_key;
+pthread_once_t laststats_once = PTHREAD_ONCE_INIT;
+
+void StatsFree(MR_Stats* stats) {
+    free(stats->partition_records);
+    free(stats->partition_bytes);
+    memset(stats, 0, sizeof(MR_Stats));
+}
+
+void laststats_free(void* stats) { StatsFree((MR_Stats*)stats); }
+
+void laststats_key_create(void) {
+    pthread_key_create(&laststats_key, laststats_free);
+}
+
+size_t* partition_array(int num_partitions) {
+    size_t* array = (size_t*)calloc(num_partitions, sizeof(size_t));
+    if (array == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    return array;
+}
+
+/**
+ * @brief Clears the numbers of the previous job and sizes the per partition
+ * arrays for the next one
+ *
+ * @param stats Pointer to MR_Stats
+ * @param num_partitions int number of partitions of the job
+ */
+void StatsReset(MR_Stats* stats, int num_partitions) {
+    StatsFree(stats);
+    stats->num_partitions = num_partitions;
+    stats->partition_records = partition_array(num_partitions);
+    stats->partition_bytes = partition_array(num_partitions);
+}
+
+/**
+ * @brief Copies the stats of a finished job to where MR_GetStats finds them,
+ * so they outlive the context that ran the job
+ *
+ * @param stats Pointer to MR_Stats
+ */
+void StatsPublish(MR_Stats* stats) {
+    size_t size = sizeof(size_t) * stats->num_partitions;
+
+    pthread_once(&laststats_once, laststats_key_create);
+    pthread_setspecific(laststats_key, &laststats);
+    StatsFree(&laststats);
+    laststats = *stats;
+    laststats.partition_records = partition_array(stats->num_partitions);
+    laststats.partition_bytes = partition_array(stats->num_partitions);
+    memcpy(laststats.partition_records, stats->partition_records, size);
+    memcpy(laststats.partition_bytes, stats->partition_bytes, size);
+}
+
+double timespec_seconds(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double StatsWallTime(void) { return timespec_seconds(CLOCK_MONOTONIC); }
+
+/**
+ * @brief CPU time of the calling thread and of the workers of `scheduler`.
+ * Other threads of the process, other contexts' workers included, are left
+ * out so that jobs running side by side do not count each other's time.
+ *
+ * @param scheduler Pointer to the Scheduler running the job
+ * @return double CPU seconds
+ */
+double job_cpu_seconds(Scheduler* scheduler) {
+    double cpu = timespec_seconds(CLOCK_THREAD_CPUTIME_ID);
+    clockid_t id;
+
+    for (int i = 0; i < scheduler->num_workers; i++) {
+        if (pthread_getcpuclockid(scheduler->threads[i], &id) == 0) {
+            cpu += timespec_seconds(id);
+        }
+    }
+    return cpu;
+}
+
+void StatsClockStart(StatsClock* clock, Scheduler* scheduler) {
+    clock->wall = timespec_seconds(CLOCK_MONOTONIC);
+    clock->cpu = job_cpu_seconds(scheduler);
+}
+
+void StatsClockStop(StatsClock* clock, MR_PhaseTime* phase,
+                    Scheduler* scheduler) {
+    phase->wall += timespec_seconds(CLOCK_MONOTONIC) - clock->wall;
+    phase->cpu += job_cpu_seconds(scheduler) - clock->cpu;
+}
+
+void json_phase(FILE* fp, char* name, MR_PhaseTime* phase) {
+    fprintf(fp, "    \"%s\": {\"wall\": %.6f, \"cpu\": %.6f},\n", name,
+            phase->wall, phase->cpu);
+}
+
+void json_array(FILE* fp, char* name, size_t* values, int n, char* end) {
+    fprintf(fp, "  \"%s\": [", name);
+    for (int i = 0; i < n; i++) {
+        fprintf(fp, i == 0 ? "%zu" : ", %zu", values[i]);
+    }
+    fprintf(fp, "]%s\n", end);
+}
+
+/**
+ * @brief Writes the stats of a job as a JSON object
+ *
+ * @param stats Pointer to MR_Stats
+ * @param path Char pointer to the file to write, "-" for stdout
+ * @return int 0 for success, -1 if the file cannot be written
+ */
+int StatsWriteJson(MR_Stats* stats, char* path) {
+    FILE* fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (fp == NULL) {
+        printf("Cannot open %s! %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(fp, "{\n  \"phases\": {\n");
+    json_phase(fp, "map", &stats->map);
+    json_phase(fp, "sort", &stats->sort);
+    json_phase(fp, "reduce", &stats->reduce);
+    fprintf(fp, "    \"total\": {\"wall\": %.6f, \"cpu\": %.6f}\n  },\n",
+            stats->total.wall, stats->total.cpu);
+    fprintf(fp, "  \"emitted_records\": %zu,\n", stats->emitted_records);
+    fprintf(fp, "  \"emitted_bytes\": %zu,\n", stats->emitted_bytes);
+    fprintf(fp, "  \"shuffled_records\": %zu,\n", stats->shuffled_records);
+    fprintf(fp, "  \"shuffled_bytes\": %zu,\n", stats->shuffled_bytes);
+    fprintf(fp, "  \"spilled_records\": %zu,\n", stats->spilled_records);
+    fprintf(fp, "  \"spilled_bytes\": %zu,\n", stats->spilled_bytes);
+    fprintf(fp, "  \"lock_wait\": %.6f,\n", stats->lock_wait);
+    fprintf(fp, "  \"arena_bytes\": %zu,\n", stats->arena_bytes);
+    fprintf(fp, "  \"index_bytes\": %zu,\n", stats->index_bytes);
+    fprintf(fp, "  \"num_partitions\": %d,\n", stats->num_partitions);
+    json_array(fp, "partition_records", stats->partition_records,
+               stats->num_partitions, ",");
+    json_array(fp, "partition_bytes", stats->partition_bytes,
+               stats->num_partitions, "");
+    fprintf(fp, "}\n");
+
+    if (fp != stdout) fclose(fp);
+    return 0;
+}
+
+MR_Stats* MR_GetStats(void) { return &laststats; }
@@ -0,0 +1,23 @@
+#ifndef __stats_h__
+#define __stats_h__
+#include "mapreduce.h"
+#include "scheduler.h"
+#include "stddef.h"
+
+// start of a phase being timed
+typedef struct {
+    double wall;
+    double cpu;
+} StatsClock;
+
+// Internal Functions
+void StatsReset(MR_Stats* stats, int num_partitions);
+void StatsPublish(MR_Stats* stats);
+void StatsFree(MR_Stats* stats);
+double StatsWallTime(void);
+void StatsClockStart(StatsClock* clock, Scheduler* scheduler);
+void StatsClockStop(StatsClock* clock, MR_PhaseTime* phase,
+                    Scheduler* scheduler);
+int StatsWriteJson(MR_Stats* stats, char* path);
+
+#endif  // __stats_h__
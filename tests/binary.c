@@ -0,0 +1,137 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../input.h"
+#include "../mapreduce.h"
+#include "check.h"
+
+// Values come back byte for byte, NULs and all, and MR_EmitInt values of
+// every size come back from MR_GetInt, whether the records stayed in memory
+// or went through a spill. Each word of the corpus is emitted under two
+// keys: the word itself with a set of integers, and the word followed by a
+// NUL and a suffix with binary values.
+
+#define SUFFIX "\0bytes"
+#define SUFFIX_LEN (sizeof(SUFFIX) - 1)
+#define MAX_WORD 1024
+
+long values[] = {0, 1, -1, 127, -128, 65536, -70000, 1L << 40, LONG_MAX,
+                 LONG_MIN};
+#define NUM_VALUES (sizeof(values) / sizeof(values[0]))
+
+// NUL, the word, two NULs and a byte past them
+size_t make_value(char *word, size_t len, char *out) {
+    out[0] = '\0';
+    memcpy(out + 1, word, len);
+    memcpy(out + 1 + len, "\0\0x", 3);
+    return len + 4;
+}
+
+void Map(char *file_name) {
+    MR_Input in;
+    MR_Tokenizer tokenizer;
+    char *line, *token;
+    char key[MAX_WORD + SUFFIX_LEN], value[MAX_WORD + 4];
+    size_t len, token_len;
+
+    if (MR_InputOpen(&in, file_name, 0, -1) != 0) exit(1);
+    while ((line = MR_InputNextLine(&in, &len)) != NULL) {
+        MR_TokenizerInit(&tokenizer, line, len);
+        while ((token = MR_NextToken(&tokenizer, &token_len)) != NULL) {
+            if (token_len > MAX_WORD) continue;
+            token[token_len] = '\0';
+            for (size_t i = 0; i < NUM_VALUES; i++) {
+                MR_EmitInt(token, values[i]);
+            }
+            memcpy(key, token, token_len);
+            memcpy(key + token_len, SUFFIX, SUFFIX_LEN);
+            MR_EmitBytes(key, token_len + SUFFIX_LEN, value,
+                         make_value(token, token_len, value));
+            MR_EmitBytes(key, token_len + SUFFIX_LEN, "", 0);
+        }
+    }
+    MR_InputClose(&in);
+}
+
+void reduce_ints(char *key, Getter get_next, int partition_number) {
+    long seen[NUM_VALUES] = {0}, value;
+
+    while (MR_GetInt(get_next, key, partition_number, &value)) {
+        size_t i = 0;
+        while (i < NUM_VALUES && values[i] != value) i++;
+        if (i == NUM_VALUES) {
+            CheckFail("key '%s' got %ld, never emitted", key, value);
+            return;
+        }
+        seen[i]++;
+    }
+    for (size_t i = 1; i < NUM_VALUES; i++) {
+        if (seen[i] != seen[0]) {
+            CheckFail("key '%s' got %ld %ld times and %ld %ld times", key,
+                      values[0], seen[0], values[i], seen[i]);
+        }
+    }
+    CheckCount(key, seen[0]);
+}
+
+void reduce_bytes(char *key, Getter get_next, int partition_number) {
+    size_t len = strlen(key);
+    char expected[MAX_WORD + 4];
+    size_t expected_len = make_value(key, len, expected);
+    long full = 0, empty = 0;
+    char *value;
+
+    if (memcmp(key + len, SUFFIX, SUFFIX_LEN) != 0) {
+        CheckFail("key '%s' lost its suffix", key);
+    }
+    while ((value = get_next(key, partition_number)) != NULL) {
+        if (MR_ValueLength() == 0) {
+            empty++;
+        } else if (MR_ValueLength() == expected_len &&
+                   memcmp(value, expected, expected_len) == 0) {
+            full++;
+        } else {
+            CheckFail("key '%s' got a %zu byte value unlike the one emitted",
+                      key, MR_ValueLength());
+        }
+    }
+    if (full != CheckExpected(key) || empty != CheckExpected(key)) {
+        CheckFail("key '%s' got %ld values and %ld empty ones, expected %ld",
+                  key, full, empty, CheckExpected(key));
+    }
+}
+
+void Reduce(char *key, Getter get_next, int partition_number) {
+    if (MR_CurrentKeyLength() == strlen(key)) {
+        reduce_ints(key, get_next, partition_number);
+    } else {
+        reduce_bytes(key, get_next, partition_number);
+    }
+}
+
+int run(int argc, char *argv[], MR_Options *options, char *name) {
+    MR_RunWithOptions(argc - 1, argv + 1, Map, 4, Reduce, 4,
+                      MR_DefaultHashPartition, options);
+    if (options->memory_budget != 0 && MR_GetStats()->spilled_records == 0) {
+        CheckFail("nothing was spilled");
+    }
+    return CheckFinish(name);
+}
+
+int main(int argc, char *argv[]) {
+    MR_Options options = {0};
+    int failed = 0;
+
+    CheckLoad(argv[1]);
+    failed |= run(argc, argv, &options, "binary values");
+
+    options.stats = 1;
+    options.memory_budget = 64 * 1024;
+    failed |= run(argc, argv, &options, "binary values through a spill");
+
+    options.grouping = MR_GROUP_HASH;
+    failed |= run(argc, argv, &options,
+                  "binary values through a spill, hash grouping");
+    return failed;
+}
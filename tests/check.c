@@ -0,0 +1,190 @@
+#include "check.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../input.h"
+
+// failures past this many are counted but not printed
+#define CHECK_MAX_REPORTS 10
+
+typedef struct {
+    char* key;
+    long count;
+    int seen;  // times CheckCount got the key in the current run
+} CheckEntry;
+
+// reference counts sorted by key
+CheckEntry* entries;
+size_t num_entries;
+long total;
+int errors;
+pthread_mutex_t checklock = PTHREAD_MUTEX_INITIALIZER;
+
+int entry_cmp(const void* a, const void* b) {
+    return strcmp(((CheckEntry*)a)->key, ((CheckEntry*)b)->key);
+}
+
+CheckEntry* entry_find(char* key) {
+    CheckEntry probe = {key, 0, 0};
+    return (CheckEntry*)bsearch(&probe, entries, num_entries,
+                                sizeof(CheckEntry), entry_cmp);
+}
+
+/**
+ * @brief Reads the reference counts
+ *
+ * @param reference Char pointer to the file, `count word` per line
+ */
+void CheckLoad(char* reference) {
+    FILE* fp = fopen(reference, "r");
+    char* line = NULL;
+    size_t capacity = 0, size = 64;
+
+    if (fp == NULL) {
+        printf("Cannot open %s! %s\n", reference, strerror(errno));
+        exit(1);
+    }
+    entries = (CheckEntry*)malloc(sizeof(CheckEntry) * size);
+    while (entries != NULL && getline(&line, &capacity, fp) > 0) {
+        char *p = line, *end;
+        long count = strtol(p, &end, 10);
+        if (end == p) continue;
+        // uniq -c puts a single space between the count and the word
+        p = end + 1;
+        end = p + strcspn(p, "\n");
+        *end = '\0';
+        if (num_entries == size) {
+            size *= 2;
+            entries = (CheckEntry*)realloc(entries, sizeof(CheckEntry) * size);
+            if (entries == NULL) break;
+        }
+        entries[num_entries].key = strdup(p);
+        entries[num_entries].count = count;
+        entries[num_entries].seen = 0;
+        num_entries++;
+        total += count;
+    }
+    if (entries == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+    free(line);
+    fclose(fp);
+    // sort(1) goes by the locale, bsearch by strcmp
+    qsort(entries, num_entries, sizeof(CheckEntry), entry_cmp);
+}
+
+long CheckExpected(char* key) {
+    CheckEntry* entry = entry_find(key);
+    return entry == NULL ? 0 : entry->count;
+}
+
+size_t CheckNumKeys(void) { return num_entries; }
+
+char* CheckKey(size_t i) { return entries[i].key; }
+
+long CheckTotal(void) { return total; }
+
+/**
+ * @brief Reports a failure, printf style
+ */
+void CheckFail(char* format, ...) {
+    va_list args;
+
+    pthread_mutex_lock(&checklock);
+    if (errors++ < CHECK_MAX_REPORTS) {
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+        printf("\n");
+    }
+    pthread_mutex_unlock(&checklock);
+}
+
+/**
+ * @brief Checks the count a run came up with for `key`. Safe to call from
+ * every reducer at once.
+ *
+ * @param key Char pointer to the key
+ * @param count long count found
+ */
+void CheckCount(char* key, long count) {
+    CheckEntry* entry = entry_find(key);
+
+    if (entry == NULL) {
+        CheckFail("unexpected key '%s' counted %ld times", key, count);
+        return;
+    }
+    if (__atomic_add_fetch(&entry->seen, 1, __ATOMIC_RELAXED) > 1) {
+        CheckFail("key '%s' reduced more than once", key);
+    }
+    if (count != entry->count) {
+        CheckFail("key '%s' counted %ld times, expected %ld", key, count,
+                  entry->count);
+    }
+}
+
+/**
+ * @brief Checks that every reference key was counted, prints the verdict
+ * and gets ready for another run
+ *
+ * @param name Char pointer to the name of the run
+ * @return int 0 if the run passed, 1 otherwise
+ */
+int CheckFinish(char* name) {
+    for (size_t i = 0; i < num_entries; i++) {
+        if (entries[i].seen == 0) {
+            CheckFail("key '%s' never reduced", entries[i].key);
+        }
+        entries[i].seen = 0;
+    }
+    return CheckVerdict(name);
+}
+
+/**
+ * @brief Prints whether CheckFail was called since the last verdict
+ *
+ * @param name Char pointer to the name of the run
+ * @return int 0 if the run passed, 1 otherwise
+ */
+int CheckVerdict(char* name) {
+    int failed = errors;
+    errors = 0;
+    if (failed != 0) {
+        printf("%s: FAILED, %d errors\n", name, failed);
+        return 1;
+    }
+    printf("%s: OK\n", name);
+    return 0;
+}
+
+void CheckMapRange(char* file_name, long offset, long length) {
+    MR_Input in;
+    MR_Tokenizer tokenizer;
+    char *line, *token;
+    size_t len, token_len;
+
+    if (MR_InputOpen(&in, file_name, offset, length) != 0) exit(1);
+    while ((line = MR_InputNextLine(&in, &len)) != NULL) {
+        MR_TokenizerInit(&tokenizer, line, len);
+        while ((token = MR_NextToken(&tokenizer, &token_len)) != NULL) {
+            token[token_len] = '\0';
+            MR_EmitInt(token, 1);
+        }
+    }
+    MR_InputClose(&in);
+}
+
+void CheckMap(char* file_name) { CheckMapRange(file_name, 0, -1); }
+
+void CheckReduce(char* key, Getter get_next, int partition_number) {
+    long count = 0, value;
+
+    while (MR_GetInt(get_next, key, partition_number, &value)) count += value;
+    CheckCount(key, count);
+}
@@ -0,0 +1,27 @@
+#ifndef __check_h__
+#define __check_h__
+#include "../mapreduce.h"
+#include "stddef.h"
+
+// Shared by the test drivers in this directory. A driver runs a word count
+// over the files tests/run.sh hands it and checks each key's count against
+// a reference, `count word` per line, written by `sort | uniq -c`.
+
+// External Functions
+void CheckLoad(char* reference);
+long CheckExpected(char* key);
+size_t CheckNumKeys(void);
+char* CheckKey(size_t i);
+long CheckTotal(void);
+void CheckCount(char* key, long count);
+void CheckFail(char* format, ...);
+int CheckFinish(char* name);
+int CheckVerdict(char* name);
+
+// Word count mappers, tokenizing like main.c and emitting 1 per word
+void CheckMap(char* file_name);
+void CheckMapRange(char* file_name, long offset, long length);
+// Sums the values of a key with MR_GetInt and passes them to CheckCount
+void CheckReduce(char* key, Getter get_next, int partition_number);
+
+#endif  // __check_h__
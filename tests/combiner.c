@@ -0,0 +1,37 @@
+#include "../mapreduce.h"
+#include "check.h"
+
+// Per-mapper partial sums from the combiner must add up to the same
+// counts as the raw pairs.
+
+size_t combined;
+
+void Combine(char *key, Getter get_next, int partition_number) {
+    long count = 0, value;
+
+    while (MR_GetInt(get_next, key, partition_number, &value)) count += value;
+    MR_EmitInt(key, count);
+    __atomic_add_fetch(&combined, 1, __ATOMIC_RELAXED);
+}
+
+int main(int argc, char *argv[]) {
+    MR_Options options = {0};
+    int failed = 0;
+
+    CheckLoad(argv[1]);
+    options.combine = Combine;
+    // MR_RunWithOptions takes the files from argv[1] on
+    MR_RunWithOptions(argc - 1, argv + 1, CheckMap, 4, CheckReduce, 4,
+                      MR_DefaultHashPartition, &options);
+    if (combined == 0) CheckFail("the combiner never ran");
+    failed |= CheckFinish("combiner");
+
+    // with the pipeline the combined output is sorted into runs
+    options.pipeline = 1;
+    combined = 0;
+    MR_RunWithOptions(argc - 1, argv + 1, CheckMap, 4, CheckReduce, 4,
+                      MR_DefaultHashPartition, &options);
+    if (combined == 0) CheckFail("the combiner never ran");
+    failed |= CheckFinish("combiner with pipeline");
+    return failed;
+}
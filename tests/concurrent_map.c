@@ -0,0 +1,120 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "../hashmap.h"
+#include "../mapreduce.h"
+#include "check.h"
+
+// ConcurrentHashMap: reducers of two jobs add into one map at once, then
+// writers update a few keys in place while readers make sure they never
+// see a value half written. Counters stop at the ends of int.
+
+#define NUM_KEYS 64
+#define NUM_THREADS 4
+#define UPDATES 200000
+
+ConcurrentHashMap *map;
+ConcurrentHashMap *updated;
+
+void Reduce(char *key, Getter get_next, int partition_number) {
+    long count = 0, value;
+
+    while (MR_GetInt(get_next, key, partition_number, &value)) count += value;
+    CMapAddIntHashed(map, key, MR_CurrentKeyHash(), count);
+}
+
+// every word of a value is the same, the last one only in big values
+typedef struct {
+    long words[3];
+} Value;
+
+void *writer(void *arg) {
+    long id = (long)arg;
+    char key[16];
+    Value value;
+
+    for (long i = 0; i < UPDATES; i++) {
+        snprintf(key, sizeof(key), "key%ld", i % NUM_KEYS);
+        value.words[0] = value.words[1] = value.words[2] = i * NUM_THREADS + id;
+        // mostly same size updates, now and then one that changes size
+        CMapPut(updated, key, &value,
+                i % 64 == 0 ? sizeof(Value) : 2 * sizeof(long));
+    }
+    return NULL;
+}
+
+void *reader(void *arg) {
+    char key[16];
+    Value value;
+
+    for (long i = 0; i < UPDATES; i++) {
+        snprintf(key, sizeof(key), "key%ld", i % NUM_KEYS);
+        if (CMapGetCopy(updated, key, &value, 2 * sizeof(long)) < 0) continue;
+        if (value.words[0] != value.words[1]) {
+            CheckFail("%s read half written: %ld and %ld", key, value.words[0],
+                      value.words[1]);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t threads[2 * NUM_THREADS];
+    int failed = 0, count;
+
+    CheckLoad(argv[1]);
+    map = CMapInit();
+    MR_Run(argc - 1, argv + 1, CheckMap, 4, Reduce, 4, MR_DefaultHashPartition);
+    MR_Run(argc - 1, argv + 1, CheckMap, 4, Reduce, 4, MR_DefaultHashPartition);
+    for (size_t i = 0; i < CheckNumKeys(); i++) {
+        char *key = CheckKey(i);
+        if (CMapGetCopy(map, key, &count, sizeof(count)) < 0) count = 0;
+        CheckCount(key, count / 2);
+        if (count % 2 != 0) CheckFail("key '%s' counted %d times", key, count);
+    }
+    if (CMapSize(map) != CheckNumKeys()) {
+        CheckFail("map holds %zu keys, expected %zu", CMapSize(map),
+                  CheckNumKeys());
+    }
+    CMapFree(map);
+    failed |= CheckFinish("concurrent map, reducers adding");
+
+    updated = CMapInit();
+    for (long i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, writer, (void *)i);
+        pthread_create(&threads[NUM_THREADS + i], NULL, reader, NULL);
+    }
+    for (int i = 0; i < 2 * NUM_THREADS; i++) pthread_join(threads[i], NULL);
+    if (CMapSize(updated) != NUM_KEYS) {
+        CheckFail("map holds %zu keys, expected %d", CMapSize(updated),
+                  NUM_KEYS);
+    }
+    CMapFree(updated);
+    failed |= CheckVerdict("concurrent map, updates in place");
+
+    ConcurrentHashMap *counters = CMapInit();
+    HashMap *plain = MapInit();
+    CMapAddInt(counters, "up", INT_MAX - 1);
+    CMapAddInt(counters, "down", INT_MIN + 1);
+    MapAddInt(plain, "up", INT_MAX - 1);
+    MapAddInt(plain, "down", INT_MIN + 1);
+    for (int i = 0; i < 3; i++) {
+        if (CMapAddInt(counters, "up", 1) != INT_MAX ||
+            MapAddInt(plain, "up", 1) != INT_MAX) {
+            CheckFail("counter went past INT_MAX");
+        }
+        if (CMapAddInt(counters, "down", -1) != INT_MIN ||
+            MapAddInt(plain, "down", -1) != INT_MIN) {
+            CheckFail("counter went past INT_MIN");
+        }
+    }
+    if (CMapAddInt(counters, "up", -1) != INT_MAX - 1 ||
+        MapAddInt(plain, "up", -1) != INT_MAX - 1) {
+        CheckFail("saturated counter does not come back down");
+    }
+    CMapFree(counters);
+    MapFree(plain);
+    failed |= CheckVerdict("concurrent map, saturating counters");
+    return failed;
+}
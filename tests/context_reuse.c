@@ -0,0 +1,108 @@
+#include <pthread.h>
+
+#include "../mapreduce.h"
+#include "check.h"
+
+// One MR_Context runs a series of jobs with different options, each of
+// which must come out right and leave nothing behind for the next. Then
+// two contexts run jobs side by side.
+
+#define JOBS 3
+
+int job_argc;
+char **job_argv;
+// records reduced by the jobs of each of the side by side contexts
+long totals[2];
+
+void Combine(char *key, Getter get_next, int partition_number) {
+    long count = 0, value;
+
+    while (MR_GetInt(get_next, key, partition_number, &value)) count += value;
+    MR_EmitInt(key, count);
+}
+
+void reduce_into(long *total, char *key, Getter get_next,
+                 int partition_number) {
+    long count = 0, value;
+
+    while (MR_GetInt(get_next, key, partition_number, &value)) count += value;
+    __atomic_add_fetch(total, count, __ATOMIC_RELAXED);
+}
+
+void Reduce0(char *key, Getter get_next, int partition_number) {
+    reduce_into(&totals[0], key, get_next, partition_number);
+}
+
+void Reduce1(char *key, Getter get_next, int partition_number) {
+    reduce_into(&totals[1], key, get_next, partition_number);
+}
+
+void *run_jobs(void *arg) {
+    long id = (long)arg;
+    MR_Context *context = MR_ContextCreate(2, NULL);
+
+    for (int i = 0; i < JOBS; i++) {
+        MR_ContextRun(context, job_argc, job_argv, CheckMap,
+                      id == 0 ? Reduce0 : Reduce1, 2, MR_DefaultHashPartition,
+                      NULL);
+    }
+    MR_ContextDestroy(context);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    MR_Options options = {0};
+    MR_Context *context = MR_ContextCreate(4, NULL);
+    pthread_t threads[2];
+    size_t arena_bytes = 0;
+    int failed = 0;
+
+    CheckLoad(argv[1]);
+    // MR_ContextRun takes the files from argv[1] on
+    job_argc = argc - 1;
+    job_argv = argv + 1;
+
+    options.stats = 1;
+    for (int i = 0; i < JOBS; i++) {
+        MR_ContextRun(context, job_argc, job_argv, CheckMap, CheckReduce, 4,
+                      MR_DefaultHashPartition, &options);
+        // the same job again takes about the same memory, give or take the
+        // odd chunk depending on which worker ran what
+        if (i == 0) {
+            arena_bytes = MR_GetStats()->arena_bytes;
+        } else if (MR_GetStats()->arena_bytes > 2 * arena_bytes) {
+            CheckFail("job %d took %zu arena bytes, job 0 took %zu", i,
+                      MR_GetStats()->arena_bytes, arena_bytes);
+        }
+        failed |= CheckFinish("context reuse, same job");
+    }
+
+    // options change from one job to the next
+    options.combine = Combine;
+    MR_ContextRun(context, job_argc, job_argv, CheckMap, CheckReduce, 4,
+                  MR_DefaultHashPartition, &options);
+    failed |= CheckFinish("context reuse, combiner");
+    options.grouping = MR_GROUP_HASH;
+    options.memory_budget = 64 * 1024;
+    MR_ContextRun(context, job_argc, job_argv, CheckMap, CheckReduce, 4,
+                  MR_DefaultHashPartition, &options);
+    failed |= CheckFinish("context reuse, hash grouping and spill");
+    options = (MR_Options){0};
+    MR_ContextRun(context, job_argc, job_argv, CheckMap, CheckReduce, 2,
+                  MR_RangePartition, &options);
+    failed |= CheckFinish("context reuse, range partition");
+    MR_ContextDestroy(context);
+
+    for (long i = 0; i < 2; i++) {
+        pthread_create(&threads[i], NULL, run_jobs, (void *)i);
+    }
+    for (int i = 0; i < 2; i++) pthread_join(threads[i], NULL);
+    for (int i = 0; i < 2; i++) {
+        if (totals[i] != JOBS * CheckTotal()) {
+            CheckFail("context %d reduced %ld records, expected %ld", i,
+                      totals[i], JOBS * CheckTotal());
+        }
+    }
+    failed |= CheckVerdict("contexts side by side");
+    return failed;
+}
@@ -0,0 +1,24 @@
+#include "../mapreduce.h"
+#include "check.h"
+
+// MR_GROUP_HASH skips the sort, keys come in any order but every one of
+// them must still be reduced once with all of its values. CheckCount flags
+// keys that show up twice.
+
+int main(int argc, char *argv[]) {
+    MR_Options options = {0};
+    int failed = 0;
+
+    CheckLoad(argv[1]);
+    options.grouping = MR_GROUP_HASH;
+    MR_RunWithOptions(argc - 1, argv + 1, CheckMap, 4, CheckReduce, 4,
+                      MR_DefaultHashPartition, &options);
+    failed |= CheckFinish("hash grouping");
+
+    // one big partition, cut into tasks that the reducers share
+    options.num_partitions = 1;
+    MR_RunWithOptions(argc - 1, argv + 1, CheckMap, 4, CheckReduce, 4,
+                      MR_DefaultHashPartition, &options);
+    failed |= CheckFinish("hash grouping, one partition");
+    return failed;
+}
@@ -0,0 +1,36 @@
+#include "../mapreduce.h"
+#include "check.h"
+
+// No more than num_mappers map calls may run at once, even when there are
+// more reducers and so more workers in the pool.
+
+int running;
+int most;
+
+void Map(char *file_name) {
+    int now = __atomic_add_fetch(&running, 1, __ATOMIC_RELAXED);
+    int seen = __atomic_load_n(&most, __ATOMIC_RELAXED);
+    while (now > seen && !__atomic_compare_exchange_n(&most, &seen, now, 0,
+                                                      __ATOMIC_RELAXED,
+                                                      __ATOMIC_RELAXED)) {
+        continue;
+    }
+    CheckMap(file_name);
+    __atomic_sub_fetch(&running, 1, __ATOMIC_RELAXED);
+}
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+
+    CheckLoad(argv[1]);
+    for (int mappers = 1; mappers <= 4; mappers *= 2) {
+        most = 0;
+        MR_Run(argc - 1, argv + 1, Map, mappers, CheckReduce, 8,
+               MR_DefaultHashPartition);
+        if (most > mappers) {
+            CheckFail("%d map calls at once with %d mappers", most, mappers);
+        }
+        failed |= CheckFinish("num_mappers below num_reducers");
+    }
+    return failed;
+}
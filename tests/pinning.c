@@ -0,0 +1,67 @@
+#define _GNU_SOURCE
+#include <sched.h>
+
+#include "../mapreduce.h"
+#include "check.h"
+
+// With pin_threads set every map and reduce call runs on a worker held to a
+// single CPU of the ones the process may use, and the counts come out the
+// same. Built with libnuma on a machine with several nodes this also keeps
+// each partition on the node of its reducers; elsewhere it just pins.
+
+#define WORKERS 4
+
+cpu_set_t allowed;
+
+void check_pinned(char *where) {
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return;
+    if (CPU_COUNT(&set) != 1) {
+        CheckFail("%s ran on %d CPUs", where, CPU_COUNT(&set));
+        return;
+    }
+    CPU_AND(&set, &set, &allowed);
+    if (CPU_COUNT(&set) != 1) CheckFail("%s ran outside the mask", where);
+}
+
+void Map(char *file_name) {
+    check_pinned("map");
+    CheckMap(file_name);
+}
+
+void Reduce(char *key, Getter get_next, int partition_number) {
+    check_pinned("reduce");
+    CheckReduce(key, get_next, partition_number);
+}
+
+int main(int argc, char *argv[]) {
+    MR_Options options = {0};
+    int failed = 0;
+
+    CheckLoad(argv[1]);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    options.pin_threads = 1;
+    MR_RunWithOptions(argc - 1, argv + 1, Map, WORKERS, Reduce, WORKERS,
+                      MR_DefaultHashPartition, &options);
+    failed |= CheckFinish("pinned workers");
+
+    // more partitions than workers are dealt out between the nodes
+    options.num_partitions = MR_AUTO_PARTITIONS;
+    options.grouping = MR_GROUP_HASH;
+    MR_RunWithOptions(argc - 1, argv + 1, Map, WORKERS, Reduce, WORKERS,
+                      MR_DefaultHashPartition, &options);
+    failed |= CheckFinish("pinned workers with hash grouping");
+
+    // the workers of a context stay pinned from job to job
+    options = (MR_Options){0};
+    options.pin_threads = 1;
+    MR_Context *context = MR_ContextCreate(WORKERS, &options);
+    for (int i = 0; i < 2; i++) {
+        MR_ContextRun(context, argc - 1, argv + 1, Map, Reduce, WORKERS,
+                      MR_RangePartition, &options);
+        failed |= CheckFinish("pinned context, range partition");
+    }
+    MR_ContextDestroy(context);
+    return failed;
+}
@@ -0,0 +1,48 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mapreduce.h"
+#include "check.h"
+
+// MR_RangePartition: counts stay exact, every partition reaches its reducer
+// sorted, and partition i only holds keys below those of partition i + 1.
+
+#define NUM_PARTITIONS 16
+
+// first and last key each partition handed to its reducer
+char *first[NUM_PARTITIONS];
+char *last[NUM_PARTITIONS];
+
+void Reduce(char *key, Getter get_next, int partition_number) {
+    // a partition is reduced by one thread at a time, in key order
+    if (last[partition_number] != NULL &&
+        strcmp(last[partition_number], key) >= 0) {
+        CheckFail("partition %d: '%s' came after '%s'", partition_number, key,
+                  last[partition_number]);
+    }
+    if (first[partition_number] == NULL) first[partition_number] = strdup(key);
+    free(last[partition_number]);
+    last[partition_number] = strdup(key);
+    CheckReduce(key, get_next, partition_number);
+}
+
+int main(int argc, char *argv[]) {
+    MR_Options options = {0};
+    int prev = -1;
+
+    CheckLoad(argv[1]);
+    // more partitions than reducers, taken as reducers free up
+    options.num_partitions = NUM_PARTITIONS;
+    MR_RunWithOptions(argc - 1, argv + 1, CheckMap, 4, Reduce, 4,
+                      MR_RangePartition, &options);
+
+    for (int i = 0; i < NUM_PARTITIONS; i++) {
+        if (first[i] == NULL) continue;
+        if (prev >= 0 && strcmp(last[prev], first[i]) >= 0) {
+            CheckFail("partitions %d and %d overlap: '%s' >= '%s'", prev, i,
+                      last[prev], first[i]);
+        }
+        prev = i;
+    }
+    return CheckFinish("range partition");
+}
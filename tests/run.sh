@@ -0,0 +1,44 @@
+#!/bin/sh
+# Runs the behavior tests: every tests/*.c but check.c is a driver that
+# word counts a corpus with one feature turned on and checks the result
+# against counts from sort | uniq -c.
+#
+# Usage: tests/run.sh [test ...]
+#
+# Runs the named tests (e.g. combiner spill), all of them by default. Set
+# CFLAGS to build differently, e.g. CFLAGS="-O1 -g -fsanitize=address".
+
+set -e
+cd "$(dirname "$0")/.."
+
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2 -g}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+if [ $# -eq 0 ]; then
+    set -- $(ls tests/*.c | sed -e '/\/check\.c$/d' -e 's/.*\/\(.*\)\.c$/\1/')
+fi
+
+NUMA=
+if printf '#include <numa.h>\nint main(void) { return numa_available(); }\n' |
+    $CC -x c -o "$WORK/numa" - -lnuma 2>/dev/null; then
+    NUMA="-DMR_HAVE_LIBNUMA -lnuma"
+fi
+LIB="tests/check.c mapreduce.c hashmap.c arena.c input.c scheduler.c \
+tokenizer.c stats.c topology.c sketch.c"
+
+# the checked in texts plus a skewed corpus with many more keys
+$CC -O2 -o "$WORK/gencorpus" bench/gencorpus.c -lm
+mkdir "$WORK/zipf"
+"$WORK/gencorpus" zipf "$WORK/zipf" 4 > /dev/null
+FILES="file1m.txt basic.txt $(ls "$WORK"/zipf/*.txt)"
+cat $FILES | tr ' \t\r' '\n\n\n' | sed '/^$/d' | LC_ALL=C sort |
+    uniq -c > "$WORK/reference"
+
+failed=0
+for test in "$@"; do
+    $CC $CFLAGS -pthread -o "$WORK/$test" "tests/$test.c" $LIB $NUMA
+    "$WORK/$test" "$WORK/reference" $FILES || failed=1
+done
+exit $failed
@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mapreduce.h"
+#include "check.h"
+
+// MR_RunSketch: no estimate is below the true count, all but about a delta
+// share of them are within epsilon times the total above it, and the
+// heaviest keys are found by name.
+
+#define EPSILON 0.001
+#define DELTA 0.01
+#define TOP 10
+
+// reference keys by count, heaviest first
+int by_count(const void *a, const void *b) {
+    long ca = CheckExpected(*(char **)a), cb = CheckExpected(*(char **)b);
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    MR_Options options = {0};
+    MR_HeavyHitter top[TOP];
+    size_t over = 0;
+
+    CheckLoad(argv[1]);
+    options.sketch_epsilon = EPSILON;
+    options.sketch_delta = DELTA;
+    MR_Sketch *sketch = MR_RunSketch(argc - 1, argv + 1, CheckMap, 4, &options);
+
+    if (MR_SketchTotal(sketch) != (unsigned long)CheckTotal()) {
+        CheckFail("total %lu, expected %ld", MR_SketchTotal(sketch),
+                  CheckTotal());
+    }
+    double bound = EPSILON * CheckTotal();
+    for (size_t i = 0; i < CheckNumKeys(); i++) {
+        char *key = CheckKey(i);
+        long exact = CheckExpected(key);
+        unsigned long count = MR_SketchCount(sketch, key, strlen(key));
+        if (count < (unsigned long)exact) {
+            CheckFail("key '%s' estimated %lu, below its count %ld", key,
+                      count, exact);
+        } else if (count - exact > bound) {
+            over++;
+        }
+    }
+    if (over > DELTA * CheckNumKeys() + 1) {
+        CheckFail("%zu of %zu keys off by more than %.0f", over,
+                  CheckNumKeys(), bound);
+    }
+
+    // heavy hitters bracket their true counts
+    int n = MR_SketchTopK(sketch, TOP, top);
+    for (int i = 0; i < n; i++) {
+        long exact = CheckExpected(top[i].key);
+        if (top[i].count < (unsigned long)exact ||
+            top[i].count - top[i].error > (unsigned long)exact) {
+            CheckFail("heavy hitter '%s' has %lu - %lu, count %ld", top[i].key,
+                      top[i].count, top[i].error, exact);
+        }
+    }
+    // and the clear winners are among them
+    char **keys = (char **)malloc(sizeof(char *) * CheckNumKeys());
+    for (size_t i = 0; i < CheckNumKeys(); i++) keys[i] = CheckKey(i);
+    qsort(keys, CheckNumKeys(), sizeof(char *), by_count);
+    for (size_t i = 0; i < TOP / 2 && i < CheckNumKeys(); i++) {
+        int found = 0;
+        for (int j = 0; j < n; j++) found |= strcmp(top[j].key, keys[i]) == 0;
+        if (!found) CheckFail("'%s' missing from the heavy hitters", keys[i]);
+    }
+    free(keys);
+    MR_SketchFree(sketch);
+    return CheckVerdict("sketch");
+}
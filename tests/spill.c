@@ -0,0 +1,57 @@
+#include "../arena.h"
+#include "../mapreduce.h"
+#include "check.h"
+
+// A memory budget far below the corpus forces partitions to disk. The runs
+// merged back must give the same counts, whichever way values are grouped,
+// and the records held in memory must stay close to the budget.
+
+#define MEMORY_BUDGET (64 * 1024)
+#define WORKERS 4
+// big enough that the budget, not the workers' first arena chunks, is what
+// limits the arenas, and a fraction of the records the corpus makes
+#define BOUNDED_BUDGET (4 * 1024 * 1024)
+
+int run(int argc, char *argv[], MR_Options *options, char *name) {
+    options->memory_budget = MEMORY_BUDGET;
+    options->stats = 1;
+    MR_RunWithOptions(argc - 1, argv + 1, CheckMap, WORKERS, CheckReduce,
+                      WORKERS, MR_DefaultHashPartition, options);
+    if (MR_GetStats()->spilled_records == 0) CheckFail("nothing was spilled");
+    return CheckFinish(name);
+}
+
+int main(int argc, char *argv[]) {
+    MR_Options options = {0};
+    int failed = 0;
+
+    CheckLoad(argv[1]);
+    failed |= run(argc, argv, &options, "spill");
+
+    options.grouping = MR_GROUP_HASH;
+    failed |= run(argc, argv, &options, "spill with hash grouping");
+
+    // files split between mappers, with more partitions than reducers
+    options = (MR_Options){0};
+    options.map_range = CheckMapRange;
+    options.split_size = 256 * 1024;
+    options.num_partitions = MR_AUTO_PARTITIONS;
+    failed |= run(argc, argv, &options, "spill with splits and partitions");
+
+    // the budget plus the margin mappers may run ahead by, and a partly
+    // used chunk per worker
+    options = (MR_Options){0};
+    options.stats = 1;
+    options.memory_budget = BOUNDED_BUDGET;
+    MR_RunWithOptions(argc - 1, argv + 1, CheckMap, WORKERS, CheckReduce,
+                      WORKERS, MR_DefaultHashPartition, &options);
+    size_t bound = BOUNDED_BUDGET + BOUNDED_BUDGET / 8 +
+                   (size_t)WORKERS * ARENA_CHUNK_SIZE;
+    if (MR_GetStats()->spilled_records == 0) CheckFail("nothing was spilled");
+    if (MR_GetStats()->arena_bytes > bound) {
+        CheckFail("%zu arena bytes with a budget of %d",
+                  MR_GetStats()->arena_bytes, BOUNDED_BUDGET);
+    }
+    failed |= CheckFinish("spill within the budget");
+    return failed;
+}
@@ -0,0 +1,125 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "mapreduce.h"
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+int is_delim(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/**
+ * @brief Scalar scan for the first byte that is (or is not) a delimiter
+ *
+ * @param p Char pointer to the first byte to look at
+ * @param end Char pointer one past the last byte
+ * @param delim int 1 to stop at a delimiter, 0 to stop at anything else
+ * @return char* the byte found, `end` if there is none
+ */
+char* scan_scalar(char* p, char* end, int delim) {
+    while (p < end && is_delim(*p) != delim) p++;
+    return p;
+}
+
+#ifdef __SSE2__
+/**
+ * @brief Bitmask of the delimiters among the 16 bytes at p
+ */
+unsigned int delim_mask16(const char* p) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+    return _mm_movemask_epi8(m);
+}
+
+char* scan_sse2(char* p, char* end, int delim) {
+    for (; end - p >= 16; p += 16) {
+        unsigned int mask = delim_mask16(p);
+        if (!delim) mask = ~mask & 0xffff;
+        if (mask != 0) return p + __builtin_ctz(mask);
+    }
+    return scan_scalar(p, end, delim);
+}
+
+/**
+ * @brief Bitmask of the delimiters among the 32 bytes at p
+ */
+__attribute__((target("avx2"))) unsigned int delim_mask32(const char* p) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+    return _mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2"))) char* scan_avx2(char* p, char* end,
+                                                  int delim) {
+    for (; end - p >= 32; p += 32) {
+        unsigned int mask = delim_mask32(p);
+        if (!delim) mask = ~mask;
+        if (mask != 0) return p + __builtin_ctz(mask);
+    }
+    return scan_sse2(p, end, delim);
+}
+
+// set once by the first MR_TokenizerInit, before any scan reads it
+int has_avx2 = 0;
+pthread_once_t has_avx2_once = PTHREAD_ONCE_INIT;
+
+void has_avx2_init(void) { has_avx2 = __builtin_cpu_supports("avx2"); }
+#endif
+
+/**
+ * @brief Finds the first byte that is (or is not) a delimiter with the
+ * widest vector unit the CPU has
+ */
+char* scan(char* p, char* end, int delim) {
+#ifdef __SSE2__
+    return has_avx2 ? scan_avx2(p, end, delim) : scan_sse2(p, end, delim);
+#else
+    return scan_scalar(p, end, delim);
+#endif
+}
+
+/**
+ * @brief Starts tokenizing `len` bytes of text
+ *
+ * @param t Pointer to MR_Tokenizer
+ * @param text Char pointer to the text
+ * @param len size_t length of the text
+ */
+void MR_TokenizerInit(MR_Tokenizer* t, char* text, size_t len) {
+#ifdef __SSE2__
+    pthread_once(&has_avx2_once, has_avx2_init);
+#endif
+    t->pos = text;
+    t->end = text + len;
+}
+
+/**
+ * @brief Hands out the next token, runs of delimiters are skipped as one
+ *
+ * @param t Pointer to MR_Tokenizer
+ * @param len Pointer receiving the token length
+ * @return char* start of the token, NULL if there are no more
+ */
+char* MR_NextToken(MR_Tokenizer* t, size_t* len) {
+    char* token = scan(t->pos, t->end, 0);
+    if (token == t->end) {
+        t->pos = t->end;
+        return NULL;
+    }
+
+    char* stop = scan(token + 1, t->end, 1);
+    *len = stop - token;
+    // step over the delimiter now, the caller may overwrite it
+    t->pos = stop < t->end ? stop + 1 : stop;
+    return token;
+}
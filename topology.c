@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include "topology.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef MR_HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+/**
+ * @brief NUMA node of a CPU, 0 when libnuma is missing or unusable
+ *
+ * @param cpu int CPU number
+ * @return int node number
+ */
+int cpu_node(int cpu) {
+#ifdef MR_HAVE_LIBNUMA
+    if (numa_available() >= 0) {
+        int node = numa_node_of_cpu(cpu);
+        if (node >= 0) return node;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * @brief Picks a CPU for each of `num_workers` workers among those the
+ * calling thread may run on. Consecutive workers go to different nodes, so
+ * a small pool still gets the memory bandwidth of every node, and more
+ * workers than CPUs wrap around.
+ *
+ * @param num_workers int number of workers
+ * @return Topology* Pointer to Topology
+ */
+Topology* TopologyInit(int num_workers) {
+    Topology* topology = (Topology*)calloc(1, sizeof(Topology));
+    cpu_set_t set;
+    int num_cpus = 0;
+
+    topology->num_workers = num_workers;
+    topology->cpus = (int*)malloc(sizeof(int) * num_workers);
+    topology->nodes = (int*)malloc(sizeof(int) * num_workers);
+    int* cpus = (int*)malloc(sizeof(int) * CPU_SETSIZE);
+    int* nodes = (int*)malloc(sizeof(int) * CPU_SETSIZE);
+    if (topology->cpus == NULL || topology->nodes == NULL || cpus == NULL ||
+        nodes == NULL) {
+        printf("Malloc error! %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &set)) continue;
+            cpus[num_cpus] = cpu;
+            nodes[num_cpus] = cpu_node(cpu);
+            if (nodes[num_cpus] >= topology->num_nodes) {
+                topology->num_nodes = nodes[num_cpus] + 1;
+            }
+            num_cpus++;
+        }
+    }
+    if (num_cpus == 0) {
+        // no mask to go by, the workers are left where they are
+        cpus[0] = -1;
+        nodes[0] = 0;
+        num_cpus = 1;
+        topology->num_nodes = 1;
+    }
+
+    // deal the CPUs out one node at a time: the first CPU of each node, then
+    // the second of each, and so on
+    int* order = (int*)malloc(sizeof(int) * num_cpus);
+    int n = 0;
+    for (int rank = 0; n < num_cpus; rank++) {
+        for (int node = 0; node < topology->num_nodes; node++) {
+            int seen = 0;
+            for (int i = 0; i < num_cpus; i++) {
+                if (nodes[i] != node) continue;
+                if (seen++ == rank) {
+                    order[n++] = i;
+                    break;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < num_workers; i++) {
+        topology->cpus[i] = cpus[order[i % num_cpus]];
+        topology->nodes[i] = nodes[order[i % num_cpus]];
+    }
+    free(order);
+    free(cpus);
+    free(nodes);
+    return topology;
+}
+
+/**
+ * @brief Pins the calling thread to the CPU of worker `worker`
+ *
+ * @param topology Pointer to Topology
+ * @param worker int index of the calling worker
+ */
+void TopologyPin(Topology* topology, int worker) {
+    cpu_set_t set;
+    int cpu = topology->cpus[worker];
+
+    if (cpu < 0) return;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    // a CPU taken offline since TopologyInit only costs the placement
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#ifdef MR_HAVE_LIBNUMA
+    // whatever the thread allocates itself comes from its own node
+    if (numa_available() >= 0) numa_set_localalloc();
+#endif
+}
+
+/**
+ * @brief Asks for the pages of [p, p + size) to be placed on `node`. Must be
+ * called before the pages are first touched.
+ *
+ * @param p Void pointer to page aligned memory
+ * @param size size_t bytes
+ * @param node int NUMA node
+ */
+void TopologyBind(void* p, size_t size, int node) {
+#ifdef MR_HAVE_LIBNUMA
+    if (numa_available() >= 0) numa_tonode_memory(p, size, node);
+#else
+    (void)p;
+    (void)size;
+    (void)node;
+#endif
+}
+
+void TopologyFree(Topology* topology) {
+    free(topology->cpus);
+    free(topology->nodes);
+    free(topology);
+}
@@ -0,0 +1,22 @@
+#ifndef __topology_h__
+#define __topology_h__
+#include "stddef.h"
+
+// Where the workers of a pool run. Built with -DMR_HAVE_LIBNUMA (and
+// -lnuma) the NUMA nodes of the CPUs are looked up and memory can be bound
+// to them. Without it, or on a host without NUMA, every worker is on node 0
+// and binding does nothing, pinning still works.
+typedef struct {
+    int num_workers;
+    int num_nodes;
+    int* cpus;   // CPU each worker is pinned to
+    int* nodes;  // NUMA node of that CPU
+} Topology;
+
+// External Functions
+Topology* TopologyInit(int num_workers);
+void TopologyPin(Topology* topology, int worker);
+void TopologyBind(void* p, size_t size, int node);
+void TopologyFree(Topology* topology);
+
+#endif  // __topology_h__